@@ -19,7 +19,7 @@ using namespace std;
 
 void load_data_file(char *file_name, int& is_binary, unsigned long& number_of_features, unsigned long& number_of_instances, map<unsigned long, 
 					lasvm_sparsevector_t>& X, map<unsigned long, int>& Y, vector<double>& x_square, int kernel_type, double& kgamma, 
-					int& is_sparse, map<unsigned long, int> splits){
+					int& is_sparse, map<unsigned long, int>& splits){
 	cout << "[Loading file: " << file_name << endl;
 	splits.clear();
 	x_square.clear();
@@ -54,17 +54,20 @@ void load_data_file(char *file_name, int& is_binary, unsigned long& number_of_fe
 		case 1:
 			binary_loader( file_name, is_sparse, number_of_features, number_of_instances,  X, Y);
 			break;
-		case 2:
+		case 2: {
 			int instance_index_in, labels_in;
-			splits = split_file_load(file_name, is_binary, instance_index_in, labels_in);
-			if (is_binary == 0){
-				libsvm_loader(file_name, number_of_features, number_of_instances, X, Y);
-				break;
-			}
-			else{
-				binary_loader(file_name, is_sparse, number_of_features, number_of_instances, X, Y);
-				break;
-			}
+			string data_file_name;
+			splits = split_file_load(file_name, data_file_name, is_binary, instance_index_in, labels_in);
+			if (is_binary == 0)
+				libsvm_loader(const_cast<char*>(data_file_name.c_str()), number_of_features, number_of_instances, X, Y);
+			else
+				binary_loader(const_cast<char*>(data_file_name.c_str()), is_sparse, number_of_features, number_of_instances, X, Y);
+			if (labels_in) // the split file relabels the instances it selects
+				for (map<unsigned long, int>::iterator iter = splits.begin(); iter != splits.end(); iter++)
+					if (Y.count(iter->first))
+						Y[iter->first] = iter->second;
+			break;
+		}
 		default:
 			cerr << "Illegal file type '-B" << is_binary << endl;
 			exit( EXIT_FAILURE );
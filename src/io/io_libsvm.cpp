@@ -79,6 +79,28 @@ void libsvm_loader(char* file_name, unsigned long& number_of_features, unsigned
 	}
 }
 
+bool libsvm_read_instance(istream& libsvm_stream, int& label, lasvm_sparsevector_t& feature_vector) {
+	// reads the next instance of a stream, skipping empty lines, false at the end of the stream
+	string buffer_line;
+	vector<string> features, features_;
+	while (getline(libsvm_stream, buffer_line)) {
+		boost::trim(buffer_line);
+		if (buffer_line.empty())
+			continue;
+		feature_vector.clear();
+		feature_vector[0] = 0;
+		boost::split(features, buffer_line, boost::is_any_of("\t "), boost::token_compress_on);
+		label = stoi(features[0]);
+		for (unsigned long iter = 1; iter < features.size(); iter++) {
+			boost::split(features_, features[iter], boost::is_any_of(":"));
+			if (features_.size() == 2)
+				feature_vector[stoul(features_[0])] = stod(features_[1]);
+		}
+		return true;
+	}
+	return false;
+}
+
 void libsvm_saver(char* file_name, map<unsigned long, lasvm_sparsevector_t> feature_vectors, map<unsigned long, int> labels, vector<double> x_square) {
 	ofstream libsvm_file;
 	libsvm_file.open(file_name);
@@ -1,11 +1,14 @@
 #ifndef IO_LIBSVM_H
 #define IO_LIBSVM_H
 
+#include <istream>
+
 #include "../lasvm/vector.hpp"
 
 using namespace std;
 
 void libsvm_loader(char* file_name, unsigned long& number_of_features, unsigned long& number_of_instances, map<unsigned long, lasvm_sparsevector_t>& feature_vectors, map<unsigned long, int>& labels);
+bool libsvm_read_instance(istream& libsvm_stream, int& label, lasvm_sparsevector_t& feature_vector);
 void libsvm_saver(char* file_name, map<unsigned long, lasvm_sparsevector_t> feature_vectors, map<unsigned long, int> labels, vector<double> x_square);
 
 #endif
\ No newline at end of file
@@ -12,7 +12,7 @@
 using namespace std;
 
 
-map<unsigned long,int> split_file_load( char* split_file_name , int& is_binary_file, int& instance_index_in, int& labels_in){
+map<unsigned long,int> split_file_load( char* split_file_name , string& data_file_name , int& is_binary_file, int& instance_index_in, int& labels_in){
     map<unsigned long , int> splits;
     instance_index_in = 0;
     labels_in = 0;
@@ -33,8 +33,7 @@ map<unsigned long,int> split_file_load( char* split_file_name , int& is_binary_f
         boost::split( strings_ , name , boost::is_any_of("/\\"));
         strings_.pop_back();
         strings_.push_back( strings.back() );
-        name = boost::algorithm::join(strings_, "/");
-        split_file_name = const_cast<char*>( name.c_str() );
+        data_file_name = boost::algorithm::join(strings_, "/");
         line_num ++;
 
         getline( split_file , buffer_line );
@@ -62,7 +61,6 @@ map<unsigned long,int> split_file_load( char* split_file_name , int& is_binary_f
         int label;
         long index;
         while( split_file.peek() != EOF ){
-            cout << "line_number : " << line_num - 3 << endl;
             label =0;
             index = 0;
             getline( split_file , buffer_line );
@@ -2,9 +2,10 @@
 #define IO_SPLIT_H
 
 #include <map>
+#include <string>
 
 using namespace std;
 
-map<unsigned long , int> split_file_load( char* file_name , int& is_binary_file , int& instance_index_in , int& labels_in );
+map<unsigned long , int> split_file_load( char* file_name , string& data_file_name , int& is_binary_file , int& instance_index_in , int& labels_in );
 
 #endif
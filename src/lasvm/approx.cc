@@ -0,0 +1,224 @@
+
+#include "approx.hpp"
+
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <algorithm>
+
+
+
+const char *lasvm_approx_table[] = {"none","fourier","nystrom"};
+
+
+static double sparse_dot(const lasvm_sparsevector_t& v1, const lasvm_sparsevector_t& v2){
+    // merges the two sorted feature lists without copying them
+    double dot_product = 0;
+    lasvm_sparsevector_t::const_iterator i1 = v1.begin(), i2 = v2.begin();
+    while (i1 != v1.end() && i2 != v2.end()){
+        if (i1->first < i2->first)
+            i1++;
+        else if (i2->first < i1->first)
+            i2++;
+        else
+            dot_product += (i1++)->second * (i2++)->second;
+    }
+    return dot_product;
+}
+
+static double sparse_square(const lasvm_sparsevector_t& v){
+    double square = 0;
+    for (lasvm_sparsevector_t::const_iterator iter = v.begin(); iter != v.end(); iter++)
+        square += iter->second * iter->second;
+    return square;
+}
+
+
+void lasvm_approx_fourier(lasvm_approx_t& map, double gamma, unsigned long dimension,
+                          unsigned long number_of_features, unsigned long long seed){
+    std::mt19937_64 generator(seed);
+    std::normal_distribution<double> normal(0, sqrt(2 * gamma));
+    std::uniform_real_distribution<double> uniform(0, 2 * M_PI);
+    map = lasvm_approx_t();
+    map.type = LASVM_APPROX_FOURIER;
+    map.gamma = gamma;
+    map.dimension = dimension;
+    map.number_of_features = number_of_features;
+    map.offset.resize(dimension);
+    map.omega.resize((number_of_features + 1) * dimension, 0);
+    for (unsigned long k = 0; k < dimension; k++){
+        map.offset[k] = uniform(generator);
+        for (unsigned long j = 1; j <= number_of_features; j++)
+            map.omega[j * dimension + k] = normal(generator);
+    }
+}
+
+void lasvm_approx_nystrom(lasvm_approx_t& map, double gamma, const std::vector<lasvm_sparsevector_t>& landmarks){
+    unsigned long m = landmarks.size();
+    map = lasvm_approx_t();
+    map.type = LASVM_APPROX_NYSTROM;
+    map.gamma = gamma;
+    map.dimension = m;
+    map.landmarks = landmarks;
+    map.landmark_square.resize(m);
+    for (unsigned long k = 0; k < m; k++)
+        map.landmark_square[k] = sparse_square(landmarks[k]);
+
+    std::vector<double> K(m * m);
+    for (unsigned long i = 0; i < m; i++)
+        for (unsigned long j = 0; j <= i; j++)
+            K[i * m + j] = K[j * m + i] = exp(-gamma * (map.landmark_square[i] + map.landmark_square[j]
+                                                        - 2 * sparse_dot(landmarks[i], landmarks[j])));
+
+    // Cholesky factor L of K, adding jitter to the diagonal until it is positive definite
+    std::vector<double> L(m * m);
+    double jitter = 1e-10;
+    bool positive = false;
+    while (!positive){
+        positive = true;
+        std::fill(L.begin(), L.end(), 0);
+        for (unsigned long j = 0; j < m && positive; j++){
+            double d = K[j * m + j] + jitter;
+            for (unsigned long k = 0; k < j; k++)
+                d -= L[j * m + k] * L[j * m + k];
+            if (d <= 0){
+                positive = false;
+                jitter *= 10;
+                break;
+            }
+            L[j * m + j] = sqrt(d);
+            for (unsigned long i = j + 1; i < m; i++){
+                double s = K[i * m + j];
+                for (unsigned long k = 0; k < j; k++)
+                    s -= L[i * m + k] * L[j * m + k];
+                L[i * m + j] = s / L[j * m + j];
+            }
+        }
+    }
+
+    // L^-1 is lower triangular, stored by rows
+    map.projection.assign(m * (m + 1) / 2, 0);
+    for (unsigned long c = 0; c < m; c++)
+        for (unsigned long i = c; i < m; i++){
+            double s = (i == c) ? 1 : 0;
+            for (unsigned long k = c; k < i; k++)
+                s -= L[i * m + k] * map.projection[k * (k + 1) / 2 + c];
+            map.projection[i * (i + 1) / 2 + c] = s / L[i * m + i];
+        }
+}
+
+lasvm_sparsevector_t lasvm_approx_apply(const lasvm_approx_t& map, const lasvm_sparsevector_t& x){
+    unsigned long D = map.dimension;
+    std::vector<double> z(D, 0);
+    lasvm_sparsevector_t mapped;
+
+    if (map.type == LASVM_APPROX_FOURIER){
+        for (lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+            if (iter->first >= 1 && iter->first <= map.number_of_features){
+                const double *omega = &map.omega[iter->first * D];
+                for (unsigned long k = 0; k < D; k++)
+                    z[k] += omega[k] * iter->second;
+            }
+        double scale = sqrt(2.0 / static_cast<double>(D));
+        for (unsigned long k = 0; k < D; k++)
+            z[k] = scale * cos(z[k] + map.offset[k]);
+    }
+    else if (map.type == LASVM_APPROX_NYSTROM){
+        std::vector<double> k_x(D);
+        double x_square = sparse_square(x);
+        for (unsigned long k = 0; k < D; k++)
+            k_x[k] = exp(-map.gamma * (map.landmark_square[k] + x_square - 2 * sparse_dot(map.landmarks[k], x)));
+        for (unsigned long i = 0; i < D; i++){
+            const double *row = &map.projection[i * (i + 1) / 2];
+            for (unsigned long k = 0; k <= i; k++)
+                z[i] += row[k] * k_x[k];
+        }
+    }
+    else
+        return x;
+
+    for (unsigned long k = 0; k < D; k++)
+        mapped.insert(mapped.end(), std::make_pair(k + 1, z[k]));
+    return mapped;
+}
+
+std::string lasvm_approx_print(const lasvm_approx_t& map){
+    std::ostringstream s;
+    s.precision(17);
+    unsigned long D = map.dimension;
+    if (map.type == LASVM_APPROX_FOURIER)
+        for (unsigned long k = 0; k < D; k++){
+            s << map.offset[k];
+            for (unsigned long j = 1; j <= map.number_of_features; j++)
+                s << " " << j << ":" << map.omega[j * D + k];
+            s << "\n";
+        }
+    else if (map.type == LASVM_APPROX_NYSTROM){
+        for (unsigned long k = 0; k < D; k++){
+            for (lasvm_sparsevector_t::const_iterator iter = map.landmarks[k].begin(); iter != map.landmarks[k].end(); iter++)
+                s << " " << iter->first << ":" << iter->second;
+            s << "\n";
+        }
+        for (unsigned long i = 0; i < D; i++){
+            for (unsigned long k = 0; k <= i; k++)
+                s << " " << k + 1 << ":" << map.projection[i * (i + 1) / 2 + k];
+            s << "\n";
+        }
+    }
+    return s.str();
+}
+
+static bool read_sparse(std::istream& in, lasvm_sparsevector_t& v, double *first){
+    // reads one line of index:value pairs, optionally preceded by a plain value
+    std::string line;
+    if (!std::getline(in, line))
+        return false;
+    std::replace(line.begin(), line.end(), ':', ' ');
+    std::istringstream tokens(line);
+    unsigned long index;
+    double value;
+    v.clear();
+    if (first && !(tokens >> *first))
+        return false;
+    while (tokens >> index >> value)
+        v[index] = value;
+    return true;
+}
+
+bool lasvm_approx_read(lasvm_approx_t& map, std::istream& in){
+    unsigned long D = map.dimension;
+    lasvm_sparsevector_t v;
+    if (map.type == LASVM_APPROX_FOURIER){
+        std::vector<lasvm_sparsevector_t> rows(D);
+        map.offset.resize(D);
+        map.number_of_features = 0;
+        for (unsigned long k = 0; k < D; k++){
+            if (!read_sparse(in, rows[k], &map.offset[k]))
+                return false;
+            if (!rows[k].empty())
+                map.number_of_features = std::max(map.number_of_features, rows[k].rbegin()->first);
+        }
+        map.omega.assign((map.number_of_features + 1) * D, 0);
+        for (unsigned long k = 0; k < D; k++)
+            for (lasvm_sparsevector_t::iterator iter = rows[k].begin(); iter != rows[k].end(); iter++)
+                map.omega[iter->first * D + k] = iter->second;
+    }
+    else if (map.type == LASVM_APPROX_NYSTROM){
+        map.landmarks.resize(D);
+        map.landmark_square.resize(D);
+        for (unsigned long k = 0; k < D; k++){
+            if (!read_sparse(in, map.landmarks[k], NULL))
+                return false;
+            map.landmark_square[k] = sparse_square(map.landmarks[k]);
+        }
+        map.projection.assign(D * (D + 1) / 2, 0);
+        for (unsigned long i = 0; i < D; i++){
+            if (!read_sparse(in, v, NULL))
+                return false;
+            for (lasvm_sparsevector_t::iterator iter = v.begin(); iter != v.end(); iter++)
+                if (iter->first >= 1 && iter->first <= i + 1)
+                    map.projection[i * (i + 1) / 2 + iter->first - 1] = iter->second;
+        }
+    }
+    return true;
+}
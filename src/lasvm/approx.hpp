@@ -0,0 +1,62 @@
+#ifndef APPROX_H
+#define APPROX_H
+
+
+#include <vector>
+#include <string>
+#include <istream>
+
+#include "vector.hpp"
+
+
+
+/* ------------------------------------- */
+/* EXPLICIT FEATURE MAPS FOR THE RBF KERNEL */
+
+/* A map z such that z(x).z(y) approximates exp(-gamma |x-y|^2),
+   so that a linear svm trained on z(x) approximates the rbf svm.
+   Random Fourier features: z_k(x) = sqrt(2/D) cos(omega_k.x + b_k)
+   with omega_k drawn from N(0, 2 gamma I) and b_k from U[0, 2 pi).
+   Nystrom: z(x) = L^-1 (k(l_1,x), ..., k(l_m,x)) for landmarks l_k,
+   where L is the Cholesky factor of their kernel matrix.
+   Mapped vectors have features 1..dimension. */
+
+#define LASVM_APPROX_NONE    0
+#define LASVM_APPROX_FOURIER 1
+#define LASVM_APPROX_NYSTROM 2
+
+extern const char *lasvm_approx_table[];
+
+struct lasvm_approx_t {
+    int type;
+    double gamma;
+    unsigned long dimension;
+    unsigned long number_of_features;           // Fourier: input features covered by omega
+    std::vector<double> omega;                  // Fourier: omega_k[j] at j*dimension+k
+    std::vector<double> offset;                 // Fourier: b_k
+    std::vector<lasvm_sparsevector_t> landmarks;// Nystrom: l_k
+    std::vector<double> landmark_square;        // Nystrom: |l_k|^2
+    std::vector<double> projection;             // Nystrom: L^-1, row i at i*(i+1)/2
+    lasvm_approx_t() : type(LASVM_APPROX_NONE), gamma(0), dimension(0), number_of_features(0) {}
+};
+
+/* Draws <dimension> random Fourier features over input features 1..<number_of_features>. */
+void lasvm_approx_fourier(lasvm_approx_t& map, double gamma, unsigned long dimension,
+                          unsigned long number_of_features, unsigned long long seed);
+
+/* Builds the Nystrom map of the given landmarks. */
+void lasvm_approx_nystrom(lasvm_approx_t& map, double gamma, const std::vector<lasvm_sparsevector_t>& landmarks);
+
+/* Returns z(x). Input features not covered by the map are ignored. */
+lasvm_sparsevector_t lasvm_approx_apply(const lasvm_approx_t& map, const lasvm_sparsevector_t& x);
+
+/* Writes the parameters of the map, one line per Fourier feature
+   (offset followed by omega_k) or per landmark followed by one line per row of L^-1. */
+std::string lasvm_approx_print(const lasvm_approx_t& map);
+
+/* Reads the lines written by lasvm_approx_print into a map whose type,
+   gamma and dimension are already set. Returns false on truncated input. */
+bool lasvm_approx_read(lasvm_approx_t& map, std::istream& in);
+
+#endif
+
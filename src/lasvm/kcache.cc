@@ -32,18 +32,45 @@
 #include <cstdio>
 #include <cstring>
 
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
 #include "messages.hpp"
 #include "kcache.hpp"
+#include "profile.hpp"
 
 #ifndef max
 # define max(a,b) (((a)>(b))?(a):(b))
 #endif
 
+#ifndef NOINDEX
+# define NOINDEX ((unsigned long)-1)
+#endif
+
+/* Workers of the parallel queries, started once and reused by every call */
+struct xpool {
+  std::vector<std::thread> workers;
+  std::mutex lock;
+  std::condition_variable start;
+  std::condition_variable finish;
+  std::function<void(void)> job;
+  unsigned long generation;         /* incremented for each job */
+  unsigned long running;            /* workers still running the job */
+  bool stopping;
+};
+
 struct lasvm_kcache_s {
   lasvm_kernel_t kernel_function;
   void *closure;
   unsigned long max_size;
   unsigned long current_size;
+  unsigned long threads;
+  struct xpool *pool;
   unsigned long length;
   unsigned long *i2r_swap;
   unsigned long *r2i_swap;
@@ -76,6 +103,12 @@ static void * xrealloc(void *ptr, unsigned long n){
   return ptr;
 }
 
+static unsigned long xsize(lasvm_kcache_t *self, unsigned long k)
+{
+  unsigned long n = self->row_size[k];
+  return (n == NOINDEX) ? 0 : n;
+}
+
 static void xminsize(lasvm_kcache_t *self, unsigned long n)
 {
   unsigned long ol = self->length;
@@ -98,7 +131,7 @@ static void xminsize(lasvm_kcache_t *self, unsigned long n)
 	{
 	  self->i2r_swap[i] = i;
 	  self->r2i_swap[i] = i;
-	  self->row_size[i] = -1;
+	  self->row_size[i] = NOINDEX;
 	  self->row_next[i] = i;
 	  self->row_previous[i] = i;
 	  self->row_data[i] = 0;
@@ -116,6 +149,7 @@ lasvm_kcache_t* lasvm_kcache_create(lasvm_kernel_t kernelfunc, void *closure){
   self->closure = closure;
   self->current_size = sizeof(lasvm_kcache_t);
   self->max_size = 256*1024*1024;
+  self->threads = 1;
   self->qprev = (unsigned long*)xmalloc(sizeof(unsigned long));
   self->qnext = (unsigned long*)xmalloc(sizeof(unsigned long));
   self->row_next = self->qnext + 1;
@@ -125,31 +159,93 @@ lasvm_kcache_t* lasvm_kcache_create(lasvm_kernel_t kernelfunc, void *closure){
   return self;
 }
 
+static void xworker(struct xpool *pool){
+  unsigned long seen = 0;
+  std::unique_lock<std::mutex> lock(pool->lock);
+  for (;;)
+    {
+      pool->start.wait(lock, [&](){ return pool->stopping || pool->generation != seen; });
+      if (pool->stopping)
+        return;
+      seen = pool->generation;
+      lock.unlock();
+      pool->job();
+      lock.lock();
+      if (--pool->running == 0)
+        pool->finish.notify_one();
+    }
+}
+
+static void xstop(lasvm_kcache_t *self){
+  unsigned long t;
+  if (! self->pool)
+    return;
+  {
+    std::lock_guard<std::mutex> lock(self->pool->lock);
+    self->pool->stopping = true;
+    self->pool->start.notify_all();
+  }
+  for (t=0; t<self->pool->workers.size(); t++)
+    self->pool->workers[t].join();
+  delete self->pool;
+  self->pool = 0;
+}
+
+/* Runs <job> on the calling thread and on the <threads>-1 workers, 
+   and returns when all have returned. */
+static void xparallel(lasvm_kcache_t *self, const std::function<void(void)> &job){
+  struct xpool *pool = self->pool;
+  unsigned long t;
+  if (self->threads <= 1)
+    {
+      job();
+      return;
+    }
+  if (! pool)
+    {
+      pool = self->pool = new xpool;
+      pool->generation = 0;
+      pool->running = 0;
+      pool->stopping = false;
+      for (t=1; t<self->threads; t++)
+        pool->workers.push_back(std::thread(xworker, pool));
+    }
+  {
+    std::lock_guard<std::mutex> lock(pool->lock);
+    pool->job = job;
+    pool->running = pool->workers.size();
+    pool->generation++;
+    pool->start.notify_all();
+  }
+  job();
+  std::unique_lock<std::mutex> lock(pool->lock);
+  pool->finish.wait(lock, [&](){ return pool->running == 0; });
+}
+
 void lasvm_kcache_destroy(lasvm_kcache_t *self){
   if (self){
       unsigned long i;
+      xstop(self);
       if (self->i2r_swap)
         free(self->i2r_swap);
       if (self->r2i_swap)
         free(self->r2i_swap);
       if (self->row_data){
-        for (i=0; i<self->length; i++){
+        for (i=0; i<self->length; i++)
           if (self->row_data[i])
             free(self->row_data[i]);
-          if (self->row_data)
-            free(self->row_data);
-          if (self->row_size)
-            free(self->row_size);
-          if (self->row_diag_position)
-            free(self->row_diag_position);
-          if (self->qnext)
-            free(self->qnext);
-          if (self->qprev)
-            free(self->qprev);
-          memset(self, 0, sizeof(lasvm_kcache_t));
-          free(self);
-        }
+        free(self->row_data);
       }
+      if (self->row_size)
+        free(self->row_size);
+      if (self->row_diag_position)
+        free(self->row_diag_position);
+      if (self->qnext)
+        free(self->qnext);
+      if (self->qprev)
+        free(self->qprev);
+      memset(self, 0, sizeof(lasvm_kcache_t));
+      free(self);
   }
 }
 
@@ -207,8 +303,9 @@ static void xtruncate(lasvm_kcache_t *self, unsigned long k, unsigned long nlen)
 }
 
 static void xswap(lasvm_kcache_t *self, unsigned long i1, unsigned long i2, unsigned long r1, unsigned long r2){
+  lasvm_profile_scope profile(LASVM_PHASE_SWAP);
   unsigned long k = self->row_next[-1];
-  while (k >= 0)
+  while (k != NOINDEX)
     {
       unsigned long nk = self->row_next[k];
       unsigned long n  = self->row_size[k];
@@ -229,7 +326,7 @@ static void xswap(lasvm_kcache_t *self, unsigned long i1, unsigned long i2, unsi
             }
           else
             {
-	      unsigned long arsize = self->row_size[i2];
+	      unsigned long arsize = xsize(self, i2);
               if (rr < arsize && rr != r1)
                 d[r1] = self->row_data[i2][rr];
               else
@@ -244,7 +341,7 @@ static void xswap(lasvm_kcache_t *self, unsigned long i1, unsigned long i2, unsi
             }
           else 
             {
-	      unsigned long arsize = self->row_size[i1];
+	      unsigned long arsize = xsize(self, i1);
               if (rr < arsize && rr != r2)
                 d[r2] = self->row_data[i1][rr];
               else
@@ -274,6 +371,11 @@ void lasvm_kcache_swap_ri(lasvm_kcache_t *self, unsigned long r1, unsigned long
   xswap(self, self->r2i_swap[r1], i2, r1, self->i2r_swap[i2]);
 }
 
+static double xkernel(lasvm_kcache_t *self, unsigned long i, unsigned long j){
+  lasvm_profile_scope profile(LASVM_PHASE_KERNEL);
+  return (*self->kernel_function)(i, j, self->closure);
+}
+
 double lasvm_kcache_query(lasvm_kcache_t *self, unsigned long i, unsigned long j){
   unsigned long length = self->length;
   ASSERT(i>=0);
@@ -281,19 +383,35 @@ double lasvm_kcache_query(lasvm_kcache_t *self, unsigned long i, unsigned long j
   if (i<length && j<length)
     {
       /* check cache */
-      unsigned long s = self->row_size[i];
+      unsigned long s = xsize(self, i);
       unsigned long p = self->i2r_swap[j];
       if (p < s)
 	return self->row_data[i][p];
-      else if (i == j && s >= 0)
+      else if (i == j && self->row_size[i] != NOINDEX)
 	return self->row_diag_position[i];
       p = self->i2r_swap[i];
-      s = self->row_size[j];
+      s = xsize(self, j);
       if (p < s)
 	return self->row_data[j][p];
     }
   /* compute */
-  return (*self->kernel_function)(i, j, self->closure);
+  return xkernel(self, i, j);
+}
+
+#define CHUNK 256 /* block entries or rows handed to a worker at once */
+
+void lasvm_kcache_query_block(lasvm_kcache_t *self, unsigned long ni, const unsigned long *i,
+                              unsigned long nj, const unsigned long *j, double *block){
+  unsigned long n = ni * nj;
+  std::atomic<unsigned long> next(0);
+  ASSERT(self);
+  /* the cache is only read here, workers share it safely */
+  xparallel(self, [&](){
+      unsigned long c, k;
+      for (c = next++; c*CHUNK < n; c = next++)
+        for (k=c*CHUNK; k<n && k<(c+1)*CHUNK; k++)
+          block[k] = lasvm_kcache_query(self, i[k/nj], j[k%nj]);
+    });
 }
 
 static void xpurge(lasvm_kcache_t *self){
@@ -311,7 +429,7 @@ static void xpurge(lasvm_kcache_t *self){
 
 double * lasvm_kcache_query_row(lasvm_kcache_t *self, unsigned long i, unsigned long len){
   ASSERT(i>=0);
-  if (i<self->length && len<=self->row_size[i])
+  if (i<self->length && self->row_size[i]!=NOINDEX && len<=self->row_size[i])
     {
       self->row_next[self->row_previous[i]] = self->row_next[i];
       self->row_previous[self->row_next[i]] = self->row_previous[i];
@@ -320,12 +438,13 @@ double * lasvm_kcache_query_row(lasvm_kcache_t *self, unsigned long i, unsigned
     {
       unsigned long olen, p, q;
       double *d;
+      lasvm_profile_scope profile(LASVM_PHASE_FILL);
       if (i >= self->length || len >= self->length)
 	xminsize(self, max(1+i,len));
       olen = self->row_size[i];
-      if (olen < 0)
+      if (olen == NOINDEX)
 	{
-	  self->row_diag_position[i] = (*self->kernel_function)(i, i, self->closure);
+	  self->row_diag_position[i] = xkernel(self, i, i);
 	  olen = self->row_size[i] = 0;
 	}
       xextend(self, i, len);
@@ -336,10 +455,10 @@ double * lasvm_kcache_query_row(lasvm_kcache_t *self, unsigned long i, unsigned
 	  unsigned long j = self->r2i_swap[p];
 	  if (i == j)
 	    d[p] = self->row_diag_position[i];
-	  else if (q < self->row_size[j])
+	  else if (q < xsize(self, j))
 	    d[p] = self->row_data[j][q];
 	  else
-	    d[p] = (*self->kernel_function)(i, j, self->closure);
+	    d[p] = xkernel(self, i, j);
 	}
       self->row_next[self->row_previous[i]] = self->row_next[i];
       self->row_previous[self->row_next[i]] = self->row_previous[i];
@@ -352,18 +471,94 @@ double * lasvm_kcache_query_row(lasvm_kcache_t *self, unsigned long i, unsigned
   return self->row_data[i];
 }
 
+void lasvm_kcache_query_rows(lasvm_kcache_t *self, unsigned long n, const unsigned long *i,
+                             unsigned long len, double *block){
+  std::vector<unsigned long> rows(i, i+n);
+  std::vector<unsigned long> olen;
+  std::atomic<unsigned long> next(0);
+  unsigned long a, k, largest = len;
+  ASSERT(self);
+  for (a=0; a<n; a++)
+    largest = max(largest, 1+i[a]);
+  xminsize(self, largest);
+  std::sort(rows.begin(), rows.end());
+  rows.erase(std::unique(rows.begin(), rows.end()), rows.end());
+  {
+    lasvm_profile_scope profile(LASVM_PHASE_FILL);
+    /* allocate the missing entries, the sizes stay unchanged
+       while filling so that only valid entries are read */
+    for (a=0; a<rows.size(); a++)
+      {
+        k = rows[a];
+        if (self->row_size[k] == NOINDEX)
+          {
+            self->row_diag_position[k] = xkernel(self, k, k);
+            self->row_size[k] = 0;
+          }
+        olen.push_back(self->row_size[k]);
+        if (olen[a] < len)
+          {
+            double *ndata = (double*)xmalloc(len*sizeof(double));
+            if (olen[a] > 0)
+              {
+                memcpy(ndata, self->row_data[k], olen[a] * sizeof(double));
+                free(self->row_data[k]);
+              }
+            self->row_data[k] = ndata;
+          }
+      }
+    xparallel(self, [&](){
+        unsigned long b, p;
+        for (b = next++; b < rows.size(); b = next++)
+          {
+            unsigned long r = rows[b];
+            unsigned long q = self->i2r_swap[r];
+            double *d = self->row_data[r];
+            for (p=olen[b]; p<len; p++)
+              {
+                unsigned long j = self->r2i_swap[p];
+                if (r == j)
+                  d[p] = self->row_diag_position[r];
+                else if (q < xsize(self, j))
+                  d[p] = self->row_data[j][q];
+                else
+                  d[p] = xkernel(self, r, j);
+              }
+          }
+      });
+  }
+  for (a=0; a<rows.size(); a++)
+    {
+      k = rows[a];
+      if (olen[a] < len)
+        {
+          self->row_size[k] = len;
+          self->current_size += (unsigned long)(len - olen[a]) * sizeof(double);
+        }
+      self->row_next[self->row_previous[k]] = self->row_next[k];
+      self->row_previous[self->row_next[k]] = self->row_previous[k];
+      self->row_previous[k] = -1;
+      self->row_next[k] = self->row_next[-1];
+      self->row_next[self->row_previous[k]] = k;
+      self->row_previous[self->row_next[k]] = k;
+    }
+  for (a=0; a<n; a++)
+    memcpy(block + a*len, self->row_data[i[a]], len * sizeof(double));
+  xpurge(self);
+}
+
 unsigned long lasvm_kcache_status_row(lasvm_kcache_t *self, unsigned long i){
   ASSERT(self);
   ASSERT(i>=0);
-  if (i < self->length)
-    return max(0,self->row_size[i]);
+  if (i < self->length && self->row_size[i] != NOINDEX)
+    return self->row_size[i];
   return 0;
 }
 
 void lasvm_kcache_discard_row(lasvm_kcache_t *self, unsigned long i){
   ASSERT(self);
   ASSERT(i>=0);
-  if (i<self->length && self->row_size[i]>0)
+  if (i<self->length && self->row_size[i]!=NOINDEX && self->row_size[i]>0)
     {
       self->row_next[self->row_previous[i]] = self->row_next[i];
       self->row_previous[self->row_next[i]] = self->row_previous[i];
@@ -374,6 +569,30 @@ void lasvm_kcache_discard_row(lasvm_kcache_t *self, unsigned long i){
     }
 }
 
+void lasvm_kcache_forget(lasvm_kcache_t *self, unsigned long i){
+  unsigned long k, r;
+  ASSERT(self);
+  if (i >= self->length)
+    return;
+  r = self->i2r_swap[i];
+  k = self->row_next[-1];
+  while (k != NOINDEX)
+    {
+      unsigned long nk = self->row_next[k];
+      if (k != i && r < xsize(self, k))
+        xtruncate(self, k, r);
+      k = nk;
+    }
+  if (self->row_size[i] != NOINDEX)
+    {
+      xtruncate(self, i, 0);
+      self->row_next[self->row_previous[i]] = self->row_next[i];
+      self->row_previous[self->row_next[i]] = self->row_previous[i];
+      self->row_next[i] = self->row_previous[i] = i;
+      self->row_size[i] = NOINDEX;
+    }
+}
+
 void lasvm_kcache_set_maximum_size(lasvm_kcache_t *self, unsigned long entries){
   ASSERT(self);
   ASSERT(entries>0);
@@ -386,6 +605,13 @@ unsigned long lasvm_kcache_get_maximum_size(lasvm_kcache_t *self){
   return self->max_size;
 }
 
+void lasvm_kcache_set_threads(lasvm_kcache_t *self, unsigned long nthreads){
+  ASSERT(self);
+  if (max(1,nthreads) != self->threads)
+    xstop(self);
+  self->threads = max(1,nthreads);
+}
+
 unsigned long lasvm_kcache_get_current_size(lasvm_kcache_t *self){
   ASSERT(self);
   return self->current_size;
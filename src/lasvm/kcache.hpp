@@ -79,6 +79,14 @@ void lasvm_kcache_set_maximum_size(lasvm_kcache_t *self, unsigned long entries);
  */
 unsigned long lasvm_kcache_get_maximum_size(lasvm_kcache_t *self);
 
+/* --- lasvm_kcache_set_threads
+   Sets the number of threads used by <lasvm_kcache_query_block>
+   and <lasvm_kcache_query_rows>. The default is one. The threads
+   are started by the first query and kept until the next change. The kernel function must be reentrant
+   when more than one thread is used.
+*/
+void lasvm_kcache_set_threads(lasvm_kcache_t *self, unsigned long nthreads);
+
 /* --- lasvm_kcache_get_current_size
    Returns the currently used cache memory.
    This can slighly exceed the value specified by 
@@ -92,6 +100,16 @@ unsigned long lasvm_kcache_get_current_size(lasvm_kcache_t *self);
  */
 double lasvm_kcache_query(lasvm_kcache_t *self, unsigned long i, unsigned long j);
 
+/* --- lasvm_kcache_query_block
+   Stores the Gram matrix elements (<i>[a],<j>[b]) into <block>[a*<nj>+b]
+   for all <a> smaller than <ni> and <b> smaller than <nj>.
+   Cached values are reused, missing values are computed
+   without being cached, possibly in parallel (see <lasvm_kcache_set_threads>).
+   This function will not modify the cache geometry.
+ */
+void lasvm_kcache_query_block(lasvm_kcache_t *self, unsigned long ni, const unsigned long *i, 
+                              unsigned long nj, const unsigned long *j, double *block);
+
 /* --- lasvm_kcache_query_row
    Returns the <len> first elements of row <i> of the Gram matrix.
    The cache user can modify the order of the row elements
@@ -102,6 +120,16 @@ double lasvm_kcache_query(lasvm_kcache_t *self, unsigned long i, unsigned long j
 
 double *lasvm_kcache_query_row(lasvm_kcache_t *self, unsigned long i, unsigned long len);
 
+/* --- lasvm_kcache_query_rows
+   Stores the <len> first elements of rows <i>[a] of the Gram matrix
+   into <block>[a*<len>] for all <a> smaller than <n>. The rows are
+   cached as by <lasvm_kcache_query_row>, but their missing elements
+   are computed together, possibly in parallel.
+*/
+
+void lasvm_kcache_query_rows(lasvm_kcache_t *self, unsigned long n, const unsigned long *i,
+                             unsigned long len, double *block);
+
 /* --- lasvm_kcache_status_row
    Returns the number of cached entries for row i.
 */
@@ -114,6 +142,14 @@ unsigned long lasvm_kcache_status_row(lasvm_kcache_t *self, unsigned long i);
 
 void lasvm_kcache_discard_row(lasvm_kcache_t *self, unsigned long i);
 
+/* --- lasvm_kcache_forget
+   Forgets every cached value involving example i, 
+   so that index i can be reused for another example.
+   Rows holding a value for i are truncated before its position.
+*/
+
+void lasvm_kcache_forget(lasvm_kcache_t *self, unsigned long i);
+
 
 /* --- lasvm_kcache_i2r
    --- lasvm_kcache_r2i
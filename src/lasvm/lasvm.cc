@@ -4,10 +4,16 @@
 #include <cstring>
 #include <cfloat>
 #include <cmath>
+#include <atomic>
+#include <thread>
+#include <vector>
+#include <algorithm>
+#include <utility>
 
 #include "messages.hpp"
 #include "kcache.hpp"
 #include "lasvm.hpp"
+#include "profile.hpp"
 
 #ifndef min
 # define min(a,b) (((a)<(b))?(a):(b))
@@ -17,6 +23,10 @@
 # define max(a,b) (((a)>(b))?(a):(b))
 #endif
 
+#ifndef NOINDEX
+# define NOINDEX ((unsigned long)-1)
+#endif
+
 #ifndef FLT_MAX
 # define FLT_MAX 1e+20
 #endif
@@ -31,9 +41,9 @@
 #endif
 
 #if USE_FLOAT
-# define real_t float
+# define LASVM_DEFAULT LASVM_FLOAT
 #else
-# define real_t double
+# define LASVM_DEFAULT LASVM_DOUBLE
 #endif
 
 
@@ -58,7 +68,17 @@ xrealloc(void *ptr, unsigned long n)
   return ptr;
 }
 
+/* The solver is a template over the type of the coefficients and 
+   gradients. Kernel rows are always double. Both instantiations
+   live in the library and <lasvm_t> only records which one to use. */
+
 struct lasvm_s 
+{
+  int precision;
+};
+
+template<typename real_t>
+struct lasvm_solver : public lasvm_s
 {
   lasvm_kcache_t *kernel;
   int     sumflag;
@@ -74,14 +94,53 @@ struct lasvm_s
   real_t  gmin, gmax;
   unsigned long     imin, imax;
   unsigned long     minmaxflag;
+  unsigned long     maxsv;
+  lasvm_linear_dot_t    wdot;
+  lasvm_linear_update_t wupdate;
+  void   *wclosure;
+  lasvm_observer_t observer;
+  void   *oclosure;
+  unsigned char *dirty;
 };
 
-static void
-checksize(lasvm_t *self, unsigned long l)
+/* Snapshots split the expansion in chunks of SNAPSHOT_CHUNK positions.
+   The solver flags the chunks it modifies so that publishing only 
+   copies those and shares the others with the previous snapshot. */
+#define SNAPSHOT_CHUNK 64
+#define SNAPSHOT_CHUNKS(l) (((l) + SNAPSHOT_CHUNK - 1) / SNAPSHOT_CHUNK)
+
+template<typename real_t> static void
+touch(lasvm_solver<real_t> *self, unsigned long i)
+{
+  self->dirty[i / SNAPSHOT_CHUNK] = 1;
+}
+
+template<typename real_t> static void
+touch_all(lasvm_solver<real_t> *self)
+{
+  memset(self->dirty, 1, SNAPSHOT_CHUNKS(self->maxl));
+}
+
+template<typename real_t> static void
+notify(lasvm_solver<real_t> *self, unsigned long i, double a)
+{
+  /* Reports a coefficient change to the weight vector and the observer */
+  if (self->wupdate)
+    (*self->wupdate)(i, a, self->wclosure);
+  if (self->observer)
+    (*self->observer)(i, a, self->oclosure);
+}
+
+template<typename real_t> static void
+checksize(lasvm_solver<real_t> *self, unsigned long l)
 {
   unsigned long maxl = max(l,256);
   while (maxl < l)
     maxl += maxl;
+  self->dirty = (unsigned char*)xrealloc(self->dirty, SNAPSHOT_CHUNKS(maxl));
+  if (SNAPSHOT_CHUNKS(maxl) > SNAPSHOT_CHUNKS(self->maxl))
+    memset(self->dirty + SNAPSHOT_CHUNKS(self->maxl), 1, 
+           SNAPSHOT_CHUNKS(maxl) - SNAPSHOT_CHUNKS(self->maxl));
   self->alpha = (real_t*)xrealloc(self->alpha, maxl*sizeof(real_t));
   self->cmin = (real_t*)xrealloc(self->cmin, maxl*sizeof(real_t));
   self->cmax = (real_t*)xrealloc(self->cmax, maxl*sizeof(real_t));
@@ -89,12 +148,13 @@ checksize(lasvm_t *self, unsigned long l)
   self->maxl = maxl;
 }
 
-lasvm_t *
-lasvm_create( lasvm_kcache_t *cache,
-              int sumflag, double cp, double cn )
+template<typename real_t> static lasvm_t *
+create( lasvm_kcache_t *cache, int sumflag, double cp, double cn, int precision )
 {
-  lasvm_t *self = (lasvm_t*)xmalloc(sizeof(lasvm_t));
-  memset(self, 0, sizeof(lasvm_t));
+  lasvm_solver<real_t> *self = 
+    (lasvm_solver<real_t>*)xmalloc(sizeof(lasvm_solver<real_t>));
+  memset(self, 0, sizeof(lasvm_solver<real_t>));
+  self->precision = precision;
   self->kernel = cache;
   self->cp = cp;
   self->cn = cn;
@@ -103,37 +163,60 @@ lasvm_create( lasvm_kcache_t *cache,
   return self;
 }
 
-void 
-lasvm_destroy( lasvm_t *self )
+template<typename real_t> static void
+destroy( lasvm_solver<real_t> *self )
 {
   if (self->alpha) free(self->alpha);
   if (self->cmin) free(self->cmin);
   if (self->cmax) free(self->cmax);
   if (self->g) free(self->g);
-  memset(self, 0, sizeof(lasvm_t));
+  if (self->dirty) free(self->dirty);
+  memset(self, 0, sizeof(lasvm_solver<real_t>));
   free(self);
 }
 
-unsigned long 
-lasvm_get_l( lasvm_t *self )
+template<typename real_t> static void
+set_budget( lasvm_solver<real_t> *self, unsigned long maxsv )
+{
+  self->maxsv = maxsv;
+}
+
+template<typename real_t> static void
+set_linear( lasvm_solver<real_t> *self, lasvm_linear_dot_t dot,
+                  lasvm_linear_update_t update, void *closure )
+{
+  self->wdot = dot;
+  self->wupdate = update;
+  self->wclosure = closure;
+}
+
+template<typename real_t> static void
+set_observer( lasvm_solver<real_t> *self, lasvm_observer_t observer, void *closure )
+{
+  self->observer = observer;
+  self->oclosure = closure;
+}
+
+template<typename real_t> static unsigned long
+get_l( lasvm_solver<real_t> *self )
 {
   return self->l;
 }
 
-double 
-lasvm_get_cp( lasvm_t *self )
+template<typename real_t> static double
+get_cp( lasvm_solver<real_t> *self )
 {
   return self->cp;
 }
 
-double 
-lasvm_get_cn( lasvm_t *self )
+template<typename real_t> static double
+get_cn( lasvm_solver<real_t> *self )
 {
   return self->cn;
 }
 
-unsigned long
-lasvm_get_alpha(lasvm_t *self, double *alpha)
+template<typename real_t> static unsigned long
+get_alpha(lasvm_solver<real_t> *self, double *alpha)
 {
   unsigned long i;
   unsigned long l = self->l;
@@ -142,8 +225,8 @@ lasvm_get_alpha(lasvm_t *self, double *alpha)
   return l;
 }
 
-unsigned long
-lasvm_get_sv(lasvm_t *self, unsigned long *sv)
+template<typename real_t> static unsigned long
+get_sv(lasvm_solver<real_t> *self, unsigned long *sv)
 {
   unsigned long i;
   unsigned long l = self->l;
@@ -153,8 +236,8 @@ lasvm_get_sv(lasvm_t *self, unsigned long *sv)
   return l;
 }
 
-unsigned long
-lasvm_get_g(lasvm_t *self, double *g)
+template<typename real_t> static unsigned long
+get_g(lasvm_solver<real_t> *self, double *g)
 {
   unsigned long i;
   unsigned long l = self->l;
@@ -163,15 +246,15 @@ lasvm_get_g(lasvm_t *self, double *g)
   return l;
 }
 
-static void
-minmax( lasvm_t *self )
+template<typename real_t> static void
+minmax( lasvm_solver<real_t> *self )
 {
   if (! self->minmaxflag)
     {
       unsigned long i;
       unsigned long l = self->s;
-      unsigned long imin = -1;
-      unsigned long imax = -1;
+      unsigned long imin = NOINDEX;
+      unsigned long imax = NOINDEX;
       real_t gmin = 0;
       real_t gmax = 0;
       real_t *alpha = self->alpha;
@@ -207,8 +290,8 @@ minmax( lasvm_t *self )
     }
 }
 
-static unsigned long
-gs1( lasvm_t *self, unsigned long i, double epsgr)
+template<typename real_t> static unsigned long
+gs1( lasvm_solver<real_t> *self, unsigned long i, double epsgr)
 {
   unsigned long l = self->s;
   real_t g;
@@ -216,14 +299,14 @@ gs1( lasvm_t *self, unsigned long i, double epsgr)
   double *row;
   unsigned long *r2i;
   /* Determine coordinate to process */
-  if (i < 0)
+  if (i == NOINDEX)
     {
       minmax(self);
       if (self->gmin + self->gmax < 0)
         i = self->imin;
       else
         i = self->imax;
-      if (i < 0)
+      if (i == NOINDEX)
         return 0;
     }
   /* Determine maximal step */  
@@ -256,6 +339,8 @@ gs1( lasvm_t *self, unsigned long i, double epsgr)
   if (g < 0)
     step = -step;
   self->alpha[i] += step;
+  touch(self, i);
+  notify(self, r2i[i], step);
 
 #if USE_CBLAS
   cblas_saxpy(l, -step, row, 1, self->g, 1);
@@ -270,8 +355,8 @@ gs1( lasvm_t *self, unsigned long i, double epsgr)
   return 1;
 }
 
-static unsigned long
-gs2( lasvm_t *self, unsigned long imin, unsigned long imax, double epsgr)
+template<typename real_t> static unsigned long
+gs2( lasvm_solver<real_t> *self, unsigned long imin, unsigned long imax, double epsgr)
 {
   unsigned long l = self->s;
   real_t gmin, gmax;
@@ -279,15 +364,15 @@ gs2( lasvm_t *self, unsigned long imin, unsigned long imax, double epsgr)
   double *rmin, *rmax;
   unsigned long *r2i;
   /* Determine coordinate to process */
-  if (imin < 0 || imax < 0)
+  if (imin == NOINDEX || imax == NOINDEX)
     {
       minmax(self);
-      if (imin < 0)
+      if (imin == NOINDEX)
         imin = self->imin;
-      if (imax < 0)
+      if (imax == NOINDEX)
         imax = self->imax;
     }
-  if (imin < 0 || imax < 0)
+  if (imin == NOINDEX || imax == NOINDEX)
     return 0;
   gmin = self->g[imin];
   gmax = self->g[imax];
@@ -314,6 +399,10 @@ gs2( lasvm_t *self, unsigned long imin, unsigned long imax, double epsgr)
   /* Perform update */
   self->alpha[imax] += step;
   self->alpha[imin] -= step;
+  touch(self, imax);
+  touch(self, imin);
+  notify(self, r2i[imax], step);
+  notify(self, r2i[imin], -step);
 #if USE_CBLAS
   cblas_saxpy(l, -step, rmax, 1, self->g, 1);
   cblas_saxpy(l,  step, rmin, 1, self->g, 1);
@@ -328,8 +417,8 @@ gs2( lasvm_t *self, unsigned long imin, unsigned long imax, double epsgr)
   return 1;
 }
 
-static void
-swap( lasvm_t *self, unsigned long r1, unsigned long r2)
+template<typename real_t> static void
+swap( lasvm_solver<real_t> *self, unsigned long r1, unsigned long r2)
 {
 #define swap(type, v)        \
   { type tmp = self->v[r1];  \
@@ -337,6 +426,8 @@ swap( lasvm_t *self, unsigned long r1, unsigned long r2)
     self->v[r2]=tmp; }
 
   lasvm_kcache_swap_rr(self->kernel, r1, r2);
+  touch(self, r1);
+  touch(self, r2);
   swap(real_t, alpha);
   swap(real_t, cmin);
   swap(real_t, cmax);
@@ -355,8 +446,8 @@ swap( lasvm_t *self, unsigned long r1, unsigned long r2)
 #undef swap
 }
 
-static void
-evict( lasvm_t *self )
+template<typename real_t> static void
+evict( lasvm_solver<real_t> *self )
 {
   unsigned long i;
   unsigned long l = self->l;
@@ -389,54 +480,33 @@ evict( lasvm_t *self )
     }
 }
 
-unsigned long 
-lasvm_process( lasvm_t *self, unsigned long xi, double y )
+template<typename real_t> static int
+reject( lasvm_solver<real_t> *self, double y, real_t g )
 {
-  unsigned long l = self->l;
-  unsigned long *i2r = 0;
-  double *row = 0;
-  real_t g;
-  unsigned long j;
-  /* Checks */
-  if (self->s != self->l)
-    lasvm_error("lasvm_process(): internal error\n");
-  if (y != +1 && y != -1)
-    lasvm_error("lasvm_process(): argument y must be +1 or -1\n");
-  /* Bail out if already in expansion? */
-  i2r = lasvm_kcache_i2r(self->kernel, 1+xi);
-  if (i2r[xi] < l)
-    return self->l; 
-  /* Compute gradient */
-  g = y;
-  if (l > 0)
-    {
-      row = lasvm_kcache_query_row(self->kernel, xi, l);
-      for (j=0; j<l; j++)
-	g -= self->alpha[j] * row[j];
-    }
-  /* Decide insertion */
   if (self->sumflag)
     {
       minmax(self);
       if (self->gmin < self->gmax)
 	if ((y>0 && g<self->gmin) || 
 	    (y<0 && g>self->gmax)  )
-	  {
-	    lasvm_kcache_discard_row(self->kernel, xi);
-	    return 0;
-	  }
+	  return 1;
     }
   else
     {
       if (y * g < 0)
-	{
-	  lasvm_kcache_discard_row(self->kernel, xi);
-	  return 0;
-	}
+	return 1;
     }
+  return 0;
+}
+
+template<typename real_t> static void
+insert( lasvm_solver<real_t> *self, unsigned long xi, double y, real_t g )
+{
+  unsigned long l = self->l;
   /* Insert */
   checksize(self, l+1);
   lasvm_kcache_swap_ri(self->kernel, l, xi);
+  touch(self, l);
   self->alpha[l] = 0;
   self->g[l] = g;
   if (y > 0)
@@ -454,32 +524,271 @@ lasvm_process( lasvm_t *self, unsigned long xi, double y )
   if (! self->sumflag)
     gs1(self, l, 0);
   else if (y > 0)
-    gs2(self, -1, l, 0);
+    gs2(self, NOINDEX, l, 0);
   else 
-    gs2(self, l, -1, 0);
+    gs2(self, l, NOINDEX, 0);
+  self->minmaxflag = 0;
+}
+
+template<typename real_t> static int
+unbudget1( lasvm_solver<real_t> *self, unsigned long r, int force )
+{
+  /* Removes support vector <r>. When there is a bias, its coefficient
+     is transferred to the nearest support vectors that can absorb it.
+     When they cannot absorb all of it, the rest is put back and zero
+     is returned, unless <force> is set. */
+  unsigned long l = self->l;
+  unsigned long *r2i = lasvm_kcache_r2i(self->kernel, l);
+  real_t *alpha = self->alpha;
+  real_t *cmin = self->cmin;
+  real_t *cmax = self->cmax;
+  real_t *g = self->g;
+  unsigned long i, j;
+  double *row;
+  real_t a, step;
+  /* Remove coefficient */
+  a = alpha[r];
+  row = lasvm_kcache_query_row(self->kernel, r2i[r], l);
+  for (j=0; j<l; j++)
+    g[j] += a * row[j];
+  alpha[r] = 0;
+  touch(self, r);
+  notify(self, r2i[r], -a);
+  /* Transfer it */
+  while (self->sumflag && a != 0)
+    {
+      unsigned long t = NOINDEX;
+      row = lasvm_kcache_query_row(self->kernel, r2i[r], l);
+      for (i=0; i<l; i++)
+        if (i != r)
+          if ((a > 0 && alpha[i] < cmax[i]) || (a < 0 && alpha[i] > cmin[i]))
+            if (t == NOINDEX || row[i] > row[t])
+              t = i;
+      if (t == NOINDEX && force)
+        break;
+      if (t == NOINDEX)
+        {
+          /* Nowhere to go: put the rest back */
+          for (j=0; j<l; j++)
+            g[j] -= a * row[j];
+          alpha[r] = a;
+          touch(self, r);
+          notify(self, r2i[r], a);
+          self->minmaxflag = 0;
+          return 0;
+        }
+      step = (a > 0) ? min(a, cmax[t] - alpha[t]) : max(a, cmin[t] - alpha[t]);
+      alpha[t] += step;
+      touch(self, t);
+      row = lasvm_kcache_query_row(self->kernel, r2i[t], l);
+      for (j=0; j<l; j++)
+        g[j] -= step * row[j];
+      notify(self, r2i[t], step);
+      a -= step;
+    }
+  /* Drop the example from the expansion */
+  swap(self, r, l-1);
+  self->l = self->s = l-1;
   self->minmaxflag = 0;
+  return 1;
+}
+
+template<typename real_t> static void
+unbudget( lasvm_solver<real_t> *self )
+{
+  /* Removes the support vector with the worst margin 
+     y_i f(x_i) = 1 - y_i g_i + y_i b, that is the one most likely 
+     to be noise, or the next worst when its coefficient cannot be
+     transferred. One of them always can while the coefficients sum
+     to zero: an example whose coefficient cannot move has all other
+     coefficients at their bound on its side, which leaves a zero 
+     coefficient of the other class or breaks the sum. The smallest
+     coefficient is forced out if rounding ever leaves none. */
+  unsigned long l = self->l;
+  real_t *alpha = self->alpha;
+  real_t *cmax = self->cmax;
+  real_t *g = self->g;
+  std::vector<std::pair<double,unsigned long> > order;
+  unsigned long i, r;
+  double b = 0;
+  if (l == 0)
+    return;
+  if (self->sumflag)
+    {
+      minmax(self);
+      b = (self->gmin + self->gmax) / 2;
+    }
+  for (i=0; i<l; i++)
+    {
+      double y = (cmax[i] > 0) ? +1 : -1;
+      order.push_back(std::make_pair(1 - y * g[i] + y * b, i));
+    }
+  std::sort(order.begin(), order.end());
+  for (i=0; i<l; i++)
+    if (unbudget1(self, order[i].second, 0))
+      return;
+  r = 0;
+  for (i=1; i<l; i++)
+    if (fabs(alpha[i]) < fabs(alpha[r]))
+      r = i;
+  unbudget1(self, r, 1);
+}
+
+template<typename real_t> static void
+budget( lasvm_solver<real_t> *self )
+{
+  if (self->maxsv > 0)
+    while (self->l > self->maxsv)
+      unbudget(self);
+}
+
+template<typename real_t> static unsigned long
+process( lasvm_solver<real_t> *self, unsigned long xi, double y )
+{
+  unsigned long l = self->l;
+  unsigned long *i2r = 0;
+  double *row = 0;
+  real_t g;
+  unsigned long j;
+  /* Checks */
+  if (self->s != self->l)
+    lasvm_error("lasvm_process(): internal error\n");
+  if (y != +1 && y != -1)
+    lasvm_error("lasvm_process(): argument y must be +1 or -1\n");
+  /* Bail out if already in expansion? */
+  i2r = lasvm_kcache_i2r(self->kernel, 1+xi);
+  if (i2r[xi] < l)
+    return self->l; 
+  /* Compute gradient */
+  g = y;
+  if (self->wdot)
+    g -= (*self->wdot)(xi, self->wclosure);
+  else if (l > 0)
+    {
+      row = lasvm_kcache_query_row(self->kernel, xi, l);
+      for (j=0; j<l; j++)
+	g -= self->alpha[j] * row[j];
+    }
+  /* Decide insertion */
+  if (reject(self, y, g))
+    {
+      if (! self->wdot)
+        lasvm_kcache_discard_row(self->kernel, xi);
+      return 0;
+    }
+  insert(self, xi, y, g);
+  budget(self);
   return self->l;
 }
 
+template<typename real_t> static unsigned long
+process_batch( lasvm_solver<real_t> *self, unsigned long k, 
+                     const unsigned long *xi, const double *y )
+{
+  unsigned long l = self->l;
+  unsigned long n = l + k;
+  unsigned long changed = 0;
+  unsigned long *i2r, *r2i, *col, *rcol;
+  double *block;
+  real_t *g, *oalpha;
+  unsigned long a, b, j, r;
+  /* Checks */
+  if (self->s != self->l)
+    lasvm_error("lasvm_process_batch(): internal error\n");
+  for (a=0; a<k; a++)
+    if (y[a] != +1 && y[a] != -1)
+      lasvm_error("lasvm_process_batch(): argument y must be +1 or -1\n");
+  if (k == 0)
+    return 0;
+  /* Gradients from the weight vector are always up to date */
+  if (self->wdot)
+    {
+      for (a=0; a<k; a++)
+        {
+          i2r = lasvm_kcache_i2r(self->kernel, 1+xi[a]);
+          if (i2r[xi[a]] >= self->l && process(self, xi[a], y[a]))
+            changed = 1;
+        }
+      return changed ? self->l : 0;
+    }
+  /* Columns are the current expansion followed by the candidates */
+  col = (unsigned long*)xmalloc(n*sizeof(unsigned long));
+  rcol = (unsigned long*)xmalloc(n*sizeof(unsigned long));
+  r2i = lasvm_kcache_r2i(self->kernel, l);
+  for (j=0; j<l; j++)
+    {
+      col[j] = r2i[j];
+      rcol[j] = j;
+    }
+  for (a=0; a<k; a++)
+    col[l+a] = xi[a];
+  /* Compute all kernel values at once */
+  block = (double*)xmalloc(k*n*sizeof(double));
+  lasvm_kcache_query_block(self->kernel, k, xi, n, col, block);
+  /* Compute gradients */
+  g = (real_t*)xmalloc(k*sizeof(real_t));
+  for (a=0; a<k; a++)
+    {
+      double *row = block + a*n;
+      g[a] = y[a];
+      for (j=0; j<l; j++)
+        g[a] -= self->alpha[j] * row[j];
+    }
+  /* Insert and process candidates in order */
+  oalpha = (real_t*)xmalloc(n*sizeof(real_t));
+  for (a=0; a<k; a++)
+    {
+      r = self->l;
+      i2r = lasvm_kcache_i2r(self->kernel, 1+xi[a]);
+      if (i2r[xi[a]] < r)
+        continue;
+      if (reject(self, y[a], g[a]))
+        continue;
+      /* rows below <r> keep their position when inserting */
+      rcol[r] = l + a;
+      memcpy(oalpha, self->alpha, r*sizeof(real_t));
+      oalpha[r] = 0;
+      insert(self, xi[a], y[a], g[a]);
+      changed = 1;
+      /* Update the gradients of the remaining candidates */
+      for (j=0; j<=r; j++)
+        {
+          real_t step = self->alpha[j] - oalpha[j];
+          if (step != 0)
+            for (b=a+1; b<k; b++)
+              g[b] -= step * block[b*n+rcol[j]];
+        }
+    }
+  free(oalpha);
+  free(g);
+  free(block);
+  free(rcol);
+  free(col);
+  budget(self);
+  if (changed)
+    return self->l;
+  return 0;
+}
+
 
-unsigned long 
-lasvm_reprocess(lasvm_t *self, double epsgr)
+template<typename real_t> static unsigned long
+reprocess(lasvm_solver<real_t> *self, double epsgr)
 {
   unsigned long status;
   if (self->s != self->l)
     lasvm_error("lasvm_process(): internal error\n");
   if (self->sumflag)
-    status = gs2(self, -1, -1, epsgr);
+    status = gs2(self, NOINDEX, NOINDEX, epsgr);
   else
-    status = gs1(self, -1, epsgr);
+    status = gs1(self, NOINDEX, epsgr);
   evict(self);
   if (status)
     return self->l;
   return 0;
 }
 
-static void
-shrink(lasvm_t *self)
+template<typename real_t> static void
+shrink(lasvm_solver<real_t> *self)
 {
   unsigned long i;
   unsigned long s = self->s;
@@ -509,8 +818,8 @@ shrink(lasvm_t *self)
     }
 }
 
-static void
-unshrink(lasvm_t *self)
+template<typename real_t> static void
+unshrink(lasvm_solver<real_t> *self)
 {
   unsigned long l = self->l;
   unsigned long s = self->s;
@@ -523,24 +832,32 @@ unshrink(lasvm_t *self)
       unsigned long i,j;
       for(i=s; i<l; i++)
         g[i] = (alpha[i]>0) ? 1.0 : -1.0;
-      for(j=0; j<l; j++)
-        if ((a = alpha[j]) != 0)
-          {
-	    unsigned long xj = r2i[j];
-	    unsigned long cached = lasvm_kcache_status_row(self->kernel, xj);
-            double *row = lasvm_kcache_query_row(self->kernel, r2i[j], l);
-            for (i=s; i<l; i++)
-              g[i] -= a * row[i];
-	    if (! cached) /* do not keep what was not cached */
-	      lasvm_kcache_discard_row(self->kernel, xj);
-          }
+      if (self->wdot)
+        {
+          for(i=s; i<l; i++)
+            g[i] -= (*self->wdot)(r2i[i], self->wclosure);
+        }
+      else
+        {
+          for(j=0; j<l; j++)
+            if ((a = alpha[j]) != 0)
+              {
+                unsigned long xj = r2i[j];
+                unsigned long cached = lasvm_kcache_status_row(self->kernel, xj);
+                double *row = lasvm_kcache_query_row(self->kernel, r2i[j], l);
+                for (i=s; i<l; i++)
+                  g[i] -= a * row[i];
+                if (! cached) /* do not keep what was not cached */
+                  lasvm_kcache_discard_row(self->kernel, xj);
+              }
+        }
       self->minmaxflag = 0;
       self->s = l;
     }
 }
 
-unsigned long 
-lasvm_finish(lasvm_t *self, double epsgr)
+template<typename real_t> static unsigned long
+finish(lasvm_solver<real_t> *self, double epsgr)
 {
   unsigned long iter = 0;
   unsigned long siter = 0;
@@ -553,9 +870,9 @@ lasvm_finish(lasvm_t *self, double epsgr)
           siter = iter + min(1000,self->l);
         }
       if (self->sumflag)
-        status = gs2(self, -1, -1, epsgr);
+        status = gs2(self, NOINDEX, NOINDEX, epsgr);
       else
-        status = gs1(self, -1, epsgr);
+        status = gs1(self, NOINDEX, epsgr);
       iter++;
     }
   unshrink(self);
@@ -563,8 +880,8 @@ lasvm_finish(lasvm_t *self, double epsgr)
   return iter;
 }
 
-double 
-lasvm_get_delta(lasvm_t *self)
+template<typename real_t> static double
+get_delta(lasvm_solver<real_t> *self)
 {
   double d;
   minmax(self);
@@ -572,7 +889,8 @@ lasvm_get_delta(lasvm_t *self)
   return max(0, d);
 }
 
-double lasvm_get_b(lasvm_t *self)
+template<typename real_t> static double
+get_b(lasvm_solver<real_t> *self)
 {
   if (self->sumflag)
     {
@@ -582,7 +900,8 @@ double lasvm_get_b(lasvm_t *self)
   return 0;
 }
 
-double lasvm_get_w2(lasvm_t *self)
+template<typename real_t> static double
+get_w2(lasvm_solver<real_t> *self)
 {
   unsigned long i;
   unsigned long l = self->l;
@@ -597,15 +916,23 @@ double lasvm_get_w2(lasvm_t *self)
   return s/2.0;
 }
 
-double 
-lasvm_predict(lasvm_t *self, unsigned long xi)
+template<typename real_t> static double
+predict(lasvm_solver<real_t> *self, unsigned long xi)
 {
   unsigned long l = self->l;
-  double *row = lasvm_kcache_query_row(self->kernel, xi, l);
+  double *row;
   real_t *alpha = self->alpha;
   real_t s = 0;
   if (self->sumflag)
     minmax(self);
+  if (self->wdot)
+    {
+      s = (*self->wdot)(xi, self->wclosure);
+      if (self->sumflag)
+        s += (self->gmin + self->gmax) / 2;
+      return s;
+    }
+  row = lasvm_kcache_query_row(self->kernel, xi, l);
 #if USE_CBLAS
   s = cblas_sdot(l, alpha, 1, row, 1);
 #else
@@ -620,17 +947,60 @@ lasvm_predict(lasvm_t *self, unsigned long xi)
   return s;
 }
 
-double 
-lasvm_predict_nocache(lasvm_t *self, unsigned long xi)
+template<typename real_t> static double
+predict_nocache(lasvm_solver<real_t> *self, unsigned long xi)
 { 
   unsigned long cached = lasvm_kcache_status_row(self->kernel, xi);
-  real_t s = lasvm_predict(self, xi);
+  real_t s = predict(self, xi);
   if (! cached) /* do not keep what was not cached */
     lasvm_kcache_discard_row(self->kernel, xi);
   return s;
 }
 
-void lasvm_init( lasvm_t *self, unsigned long l, 
+template<typename real_t> static void
+predict_batch(lasvm_solver<real_t> *self, unsigned long n, 
+                    const unsigned long *xi, double *f)
+{
+  unsigned long l = self->l;
+  real_t *alpha = self->alpha;
+  real_t b = 0;
+  unsigned long i, j;
+  if (self->sumflag)
+    {
+      minmax(self);
+      b = (self->gmin + self->gmax) / 2;
+    }
+  if (self->wdot)
+    for (i=0; i<n; i++)
+      f[i] = (*self->wdot)(xi[i], self->wclosure) + b;
+  else if (l > 0 && n > 0)
+    {
+      unsigned long *cached = (unsigned long*)xmalloc(n*sizeof(unsigned long));
+      double *block = (double*)xmalloc(n*l*sizeof(double));
+      for (i=0; i<n; i++)
+        cached[i] = lasvm_kcache_status_row(self->kernel, xi[i]);
+      lasvm_kcache_query_rows(self->kernel, n, xi, l, block);
+      for (i=0; i<n; i++)
+        if (! cached[i]) /* do not keep what was not cached */
+          lasvm_kcache_discard_row(self->kernel, xi[i]);
+      for (i=0; i<n; i++)
+        {
+          double *row = block + i*l;
+          real_t s = 0;
+          for (j=0; j<l; j++)
+            s += alpha[j] * row[j];
+          f[i] = s + b;
+        }
+      free(block);
+      free(cached);
+    }
+  else
+    for (i=0; i<n; i++)
+      f[i] = b;
+}
+
+template<typename real_t> static void
+init( lasvm_solver<real_t> *self, unsigned long l, 
                  const unsigned long *sv, 
                  const double *alpha, 
                  const double *g )
@@ -638,7 +1008,16 @@ void lasvm_init( lasvm_t *self, unsigned long l,
   unsigned long i,k;
   if (l <= 0)
     lasvm_error("Argument l should be positive.\n");
+  if (self->wupdate || self->observer)
+    {
+      /* remove the current expansion from the weight vector */
+      unsigned long *r2i = lasvm_kcache_r2i(self->kernel, self->l);
+      for (i=0; i<self->l; i++)
+        if (self->alpha[i])
+          notify(self, r2i[i], -self->alpha[i]);
+    }
   checksize(self, l);
+  touch_all(self);
   self->l = 0;
   for (i=k=0; i<l; i++)
     {
@@ -660,6 +1039,7 @@ void lasvm_init( lasvm_t *self, unsigned long l,
             }
           if (g)
             self->g[k] = g[i];
+          notify(self, sv[i], alpha[i]);
           k++;
         }
     }
@@ -669,7 +1049,13 @@ void lasvm_init( lasvm_t *self, unsigned long l,
       for (i=0; i<k; i++)
         {
           real_t s = self->g[i];
-          double *row = lasvm_kcache_query_row(self->kernel, r2i[i] , k);
+          double *row;
+          if (self->wdot)
+            {
+              self->g[i] = s - (*self->wdot)(r2i[i], self->wclosure);
+              continue;
+            }
+          row = lasvm_kcache_query_row(self->kernel, r2i[i] , k);
 #if USE_CBLAS
           s -= cblas_sdot(k, self->alpha, 1, row, 1);
 #else
@@ -683,4 +1069,498 @@ void lasvm_init( lasvm_t *self, unsigned long l,
         }
     }
   self->l = self->s = k;
+  self->minmaxflag = 0;
+}
+
+template<typename real_t> static void
+set_c( lasvm_solver<real_t> *self, double cp, double cn )
+{
+  unsigned long i, l = self->l;
+  unsigned long *sv;
+  double *alpha;
+  double sp = 0, sn = 0;
+  self->cp = cp;
+  self->cn = cn;
+  if (l == 0)
+    return;
+  if (self->s != l)
+    lasvm_error("lasvm_set_c(): internal error\n");
+  sv = (unsigned long*)xmalloc(l*sizeof(unsigned long));
+  alpha = (double*)xmalloc(l*sizeof(double));
+  memcpy(sv, lasvm_kcache_r2i(self->kernel, l), l*sizeof(unsigned long));
+  /* Clip into the new box */
+  for (i=0; i<l; i++)
+    {
+      alpha[i] = self->alpha[i];
+      if (self->cmax[i] > 0)
+        sp += (alpha[i] = min(alpha[i], cp));
+      else
+        sn -= (alpha[i] = max(alpha[i], -cn));
+    }
+  /* Shrink the heavier class back to the equality constraint */
+  if (self->sumflag && sp != sn)
+    {
+      double scale = (sp > sn) ? sn / sp : sp / sn;
+      for (i=0; i<l; i++)
+        if ((alpha[i] > 0) == (sp > sn))
+          alpha[i] *= scale;
+    }
+  init(self, l, sv, alpha, NULL);
+  free(sv);
+  free(alpha);
+}
+
+static void
+xfwrite(const void *p, unsigned long size, unsigned long n, FILE *f)
+{
+  if (fwrite(p, size, n, f) != n)
+    lasvm_error("Function fwrite() has failed.\n");
+}
+
+static void
+xfread(void *p, unsigned long size, unsigned long n, FILE *f)
+{
+  if (fread(p, size, n, f) != n)
+    lasvm_error("Truncated or invalid lasvm state.\n");
+}
+
+static const char state_magic[8] = { 'L','A','S','V','M','S','T','1' };
+
+template<typename real_t> static void
+save_state( lasvm_solver<real_t> *self, FILE *f )
+{
+  unsigned long i, l = self->l;
+  unsigned long *r2i = lasvm_kcache_r2i(self->kernel, l);
+  double v[4];
+  long sumflag = self->sumflag;
+  xfwrite(state_magic, 1, sizeof(state_magic), f);
+  xfwrite(&sumflag, sizeof(long), 1, f);
+  v[0] = self->cp;
+  v[1] = self->cn;
+  xfwrite(v, sizeof(double), 2, f);
+  xfwrite(&self->maxsv, sizeof(unsigned long), 1, f);
+  xfwrite(&self->s, sizeof(unsigned long), 1, f);
+  xfwrite(&l, sizeof(unsigned long), 1, f);
+  xfwrite(r2i, sizeof(unsigned long), l, f);
+  /* Coefficients are written as doubles whatever real_t is */
+  for (i=0; i<l; i++)
+    {
+      v[0] = self->alpha[i];
+      v[1] = self->cmin[i];
+      v[2] = self->cmax[i];
+      v[3] = self->g[i];
+      xfwrite(v, sizeof(double), 4, f);
+    }
+}
+
+template<typename real_t> static void
+load_state( lasvm_solver<real_t> *self, FILE *f )
+{
+  char magic[sizeof(state_magic)];
+  unsigned long i, s, l, *sv;
+  double v[4];
+  long sumflag;
+  xfread(magic, 1, sizeof(magic), f);
+  if (memcmp(magic, state_magic, sizeof(magic)))
+    lasvm_error("This is not a lasvm state.\n");
+  if (self->l > 0)
+    lasvm_error("lasvm_load_state(): the solver must be empty.\n");
+  xfread(&sumflag, sizeof(long), 1, f);
+  self->sumflag = (int)sumflag;
+  xfread(v, sizeof(double), 2, f);
+  self->cp = v[0];
+  self->cn = v[1];
+  xfread(&self->maxsv, sizeof(unsigned long), 1, f);
+  xfread(&s, sizeof(unsigned long), 1, f);
+  xfread(&l, sizeof(unsigned long), 1, f);
+  if (s > l)
+    lasvm_error("Truncated or invalid lasvm state.\n");
+  checksize(self, l);
+  touch_all(self);
+  sv = (unsigned long*)xmalloc(max(l,1)*sizeof(unsigned long));
+  xfread(sv, sizeof(unsigned long), l, f);
+  for (i=0; i<l; i++)
+    {
+      xfread(v, sizeof(double), 4, f);
+      lasvm_kcache_swap_ri(self->kernel, i, sv[i]);
+      self->alpha[i] = v[0];
+      self->cmin[i] = v[1];
+      self->cmax[i] = v[2];
+      self->g[i] = v[3];
+      if (self->alpha[i])
+        notify(self, sv[i], self->alpha[i]);
+    }
+  free(sv);
+  self->s = s;
+  self->l = l;
+  self->minmaxflag = 0;
+}
+
+/* Snapshots */
+
+struct lasvm_chunk_s
+{
+  unsigned long refs;   /* only touched by the publishing thread */
+  unsigned long sv[SNAPSHOT_CHUNK];
+  double alpha[SNAPSHOT_CHUNK];
+};
+
+struct lasvm_snapshot_s
+{
+  unsigned long l;
+  unsigned long version;
+  double b;
+  struct lasvm_chunk_s **chunks;
+};
+
+struct lasvm_publisher_s
+{
+  std::atomic<lasvm_snapshot_t*> current;
+  std::atomic<unsigned long> epoch;
+  std::atomic<unsigned long> readers[2];
+  unsigned long version;
+};
+
+static void
+snapshot_free(lasvm_snapshot_t *snap)
+{
+  unsigned long c;
+  for (c=0; c<SNAPSHOT_CHUNKS(snap->l); c++)
+    if (--snap->chunks[c]->refs == 0)
+      free(snap->chunks[c]);
+  free(snap->chunks);
+  free(snap);
+}
+
+lasvm_publisher_t *
+lasvm_publisher_create( void )
+{
+  lasvm_publisher_t *pub = new lasvm_publisher_t;
+  pub->current = 0;
+  pub->epoch = 0;
+  pub->readers[0] = 0;
+  pub->readers[1] = 0;
+  pub->version = 0;
+  return pub;
+}
+
+void 
+lasvm_publisher_destroy( lasvm_publisher_t *pub )
+{
+  lasvm_snapshot_t *snap = pub->current.load();
+  if (snap)
+    snapshot_free(snap);
+  delete pub;
+}
+
+template<typename real_t> static void
+publish( lasvm_publisher_t *pub, lasvm_solver<real_t> *self )
+{
+  unsigned long c, i, l = self->l;
+  unsigned long *r2i = lasvm_kcache_r2i(self->kernel, l);
+  lasvm_snapshot_t *old = pub->current.load();
+  lasvm_snapshot_t *snap = (lasvm_snapshot_t*)xmalloc(sizeof(lasvm_snapshot_t));
+  unsigned long oldn = old ? SNAPSHOT_CHUNKS(old->l) : 0;
+  snap->l = l;
+  snap->version = pub->version++;
+  snap->b = get_b(self);
+  snap->chunks = (struct lasvm_chunk_s**)
+    xmalloc(max(SNAPSHOT_CHUNKS(l),1) * sizeof(struct lasvm_chunk_s*));
+  for (c=0; c<SNAPSHOT_CHUNKS(l); c++)
+    {
+      struct lasvm_chunk_s *chunk;
+      unsigned long end = min(l, (c+1)*SNAPSHOT_CHUNK);
+      if (c < oldn && !self->dirty[c])
+        {
+          chunk = old->chunks[c];
+          chunk->refs += 1;
+        }
+      else
+        {
+          chunk = (struct lasvm_chunk_s*)xmalloc(sizeof(struct lasvm_chunk_s));
+          chunk->refs = 1;
+          for (i=c*SNAPSHOT_CHUNK; i<end; i++)
+            {
+              chunk->sv[i - c*SNAPSHOT_CHUNK] = r2i[i];
+              chunk->alpha[i - c*SNAPSHOT_CHUNK] = self->alpha[i];
+            }
+        }
+      snap->chunks[c] = chunk;
+    }
+  memset(self->dirty, 0, SNAPSHOT_CHUNKS(self->maxl));
+  pub->current.store(snap);
+  if (old)
+    {
+      /* Readers entering from now on register under the new parity 
+         and find the new snapshot. Wait for those of the old one. */
+      unsigned long e = pub->epoch.fetch_add(1);
+      while (pub->readers[e & 1].load() != 0)
+        std::this_thread::yield();
+      snapshot_free(old);
+    }
+}
+
+const lasvm_snapshot_t *
+lasvm_snapshot_acquire( lasvm_publisher_t *pub, unsigned long *ticket )
+{
+  for (;;)
+    {
+      unsigned long e = pub->epoch.load();
+      pub->readers[e & 1].fetch_add(1);
+      if (pub->epoch.load() == e)
+        {
+          *ticket = e & 1;
+          return pub->current.load();
+        }
+      pub->readers[e & 1].fetch_sub(1);
+    }
+}
+
+void 
+lasvm_snapshot_release( lasvm_publisher_t *pub, unsigned long ticket )
+{
+  pub->readers[ticket & 1].fetch_sub(1);
+}
+
+unsigned long 
+lasvm_snapshot_get_l( const lasvm_snapshot_t *snap )
+{
+  return snap->l;
+}
+
+double 
+lasvm_snapshot_get_b( const lasvm_snapshot_t *snap )
+{
+  return snap->b;
+}
+
+unsigned long 
+lasvm_snapshot_get_version( const lasvm_snapshot_t *snap )
+{
+  return snap->version;
+}
+
+unsigned long 
+lasvm_snapshot_get_sv( const lasvm_snapshot_t *snap, unsigned long *sv )
+{
+  unsigned long i;
+  for (i=0; i<snap->l; i++)
+    sv[i] = snap->chunks[i / SNAPSHOT_CHUNK]->sv[i % SNAPSHOT_CHUNK];
+  return snap->l;
+}
+
+unsigned long 
+lasvm_snapshot_get_alpha( const lasvm_snapshot_t *snap, double *alpha )
+{
+  unsigned long i;
+  for (i=0; i<snap->l; i++)
+    alpha[i] = snap->chunks[i / SNAPSHOT_CHUNK]->alpha[i % SNAPSHOT_CHUNK];
+  return snap->l;
+}
+
+double 
+lasvm_snapshot_predict( const lasvm_snapshot_t *snap, 
+                        lasvm_snapshot_kernel_t kernel, void *closure )
+{
+  unsigned long c, i;
+  double s = 0;
+  for (c=0; c<SNAPSHOT_CHUNKS(snap->l); c++)
+    {
+      const struct lasvm_chunk_s *chunk = snap->chunks[c];
+      unsigned long n = min(snap->l - c*SNAPSHOT_CHUNK, SNAPSHOT_CHUNK);
+      for (i=0; i<n; i++)
+        s += chunk->alpha[i] * (*kernel)(chunk->sv[i], closure);
+    }
+  return s - snap->b;
+}
+
+/* C interface */
+
+template<typename F> static auto
+dispatch( lasvm_t *self, F f ) -> decltype(f((lasvm_solver<double>*)0))
+{
+  if (self->precision == LASVM_FLOAT)
+    return f(static_cast<lasvm_solver<float>*>(self));
+  return f(static_cast<lasvm_solver<double>*>(self));
+}
+
+lasvm_t *
+lasvm_create_precision( lasvm_kcache_t *cache, int sumflag, 
+                        double cp, double cn, int precision )
+{
+  if (precision == LASVM_FLOAT)
+    return create<float>(cache, sumflag, cp, cn, precision);
+  if (precision != LASVM_DOUBLE)
+    lasvm_error("Unknown precision.\n");
+  return create<double>(cache, sumflag, cp, cn, precision);
+}
+
+lasvm_t *
+lasvm_create( lasvm_kcache_t *cache, int sumflag, double cp, double cn )
+{
+  return lasvm_create_precision(cache, sumflag, cp, cn, LASVM_DEFAULT);
+}
+
+int 
+lasvm_get_precision( lasvm_t *self )
+{
+  return self->precision;
+}
+
+void 
+lasvm_destroy( lasvm_t *self )
+{
+  dispatch(self, [](auto *s) { destroy(s); });
+}
+
+void
+lasvm_set_budget( lasvm_t *self, unsigned long maxsv )
+{
+  dispatch(self, [=](auto *s) { set_budget(s, maxsv); });
+}
+
+void
+lasvm_set_linear( lasvm_t *self, lasvm_linear_dot_t dot,
+                  lasvm_linear_update_t update, void *closure )
+{
+  dispatch(self, [=](auto *s) { set_linear(s, dot, update, closure); });
+}
+
+void
+lasvm_set_observer( lasvm_t *self, lasvm_observer_t observer, void *closure )
+{
+  dispatch(self, [=](auto *s) { set_observer(s, observer, closure); });
+}
+
+unsigned long 
+lasvm_get_l( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_l(s); });
+}
+
+unsigned long 
+lasvm_process( lasvm_t *self, unsigned long xi, double y )
+{
+  lasvm_profile_scope profile(LASVM_PHASE_PROCESS);
+  return dispatch(self, [=](auto *s) { return process(s, xi, y); });
+}
+
+unsigned long 
+lasvm_process_batch( lasvm_t *self, unsigned long k, 
+                     const unsigned long *xi, const double *y )
+{
+  lasvm_profile_scope profile(LASVM_PHASE_PROCESS);
+  return dispatch(self, [=](auto *s) { return process_batch(s, k, xi, y); });
+}
+
+unsigned long 
+lasvm_reprocess( lasvm_t *self, double epsgr )
+{
+  lasvm_profile_scope profile(LASVM_PHASE_REPROCESS);
+  return dispatch(self, [=](auto *s) { return reprocess(s, epsgr); });
+}
+
+unsigned long 
+lasvm_finish( lasvm_t *self, double epsgr )
+{
+  lasvm_profile_scope profile(LASVM_PHASE_FINISH);
+  return dispatch(self, [=](auto *s) { return finish(s, epsgr); });
+}
+
+double 
+lasvm_get_cp( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_cp(s); });
+}
+
+double 
+lasvm_get_cn( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_cn(s); });
+}
+
+void 
+lasvm_set_c( lasvm_t *self, double cp, double cn )
+{
+  dispatch(self, [=](auto *s) { set_c(s, cp, cn); });
+}
+
+double 
+lasvm_get_delta( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_delta(s); });
+}
+
+unsigned long 
+lasvm_get_alpha( lasvm_t *self, double *alpha )
+{
+  return dispatch(self, [=](auto *s) { return get_alpha(s, alpha); });
+}
+
+unsigned long 
+lasvm_get_sv( lasvm_t *self, unsigned long *sv )
+{
+  return dispatch(self, [=](auto *s) { return get_sv(s, sv); });
+}
+
+unsigned long 
+lasvm_get_g( lasvm_t *self, double *g )
+{
+  return dispatch(self, [=](auto *s) { return get_g(s, g); });
+}
+
+double 
+lasvm_get_b( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_b(s); });
+}
+
+double 
+lasvm_get_w2( lasvm_t *self )
+{
+  return dispatch(self, [](auto *s) { return get_w2(s); });
+}
+
+double 
+lasvm_predict( lasvm_t *self, unsigned long xi )
+{
+  return dispatch(self, [=](auto *s) { return predict(s, xi); });
+}
+
+double 
+lasvm_predict_nocache( lasvm_t *self, unsigned long xi )
+{
+  return dispatch(self, [=](auto *s) { return predict_nocache(s, xi); });
+}
+
+void 
+lasvm_predict_batch( lasvm_t *self, unsigned long n, 
+                     const unsigned long *xi, double *f )
+{
+  dispatch(self, [=](auto *s) { predict_batch(s, n, xi, f); });
+}
+
+void 
+lasvm_init( lasvm_t *self, unsigned long l, const unsigned long *sv, 
+            const double *alpha, const double *g )
+{
+  dispatch(self, [=](auto *s) { init(s, l, sv, alpha, g); });
+}
+
+void 
+lasvm_save_state( lasvm_t *self, FILE *f )
+{
+  dispatch(self, [=](auto *s) { save_state(s, f); });
+}
+
+void 
+lasvm_load_state( lasvm_t *self, FILE *f )
+{
+  dispatch(self, [=](auto *s) { load_state(s, f); });
+}
+
+void 
+lasvm_publish( lasvm_publisher_t *pub, lasvm_t *self )
+{
+  dispatch(self, [=](auto *s) { publish(pub, s); });
 }
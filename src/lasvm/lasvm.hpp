@@ -1,6 +1,8 @@
 #ifndef LASVM_H
 #define LASVM_H
 
+#include <cstdio>
+
 #include "kcache.hpp"
 
 /* --- lasvm_t
@@ -20,12 +22,71 @@ typedef struct lasvm_s lasvm_t;
 */
 lasvm_t *lasvm_create( lasvm_kcache_t *cache, int sumflag, double cp, double cn );
 
+/* --- lasvm_create_precision, lasvm_get_precision
+   Same as <lasvm_create>, but stores the coefficients and gradients
+   as double (<LASVM_DOUBLE>) or float (<LASVM_FLOAT>) according to 
+   <precision>. Both solvers are in the library and share the same 
+   interface. <lasvm_create> uses double unless the library is compiled
+   with USE_FLOAT. Function <lasvm_get_precision> returns the precision
+   of a solver.
+*/
+#define LASVM_DOUBLE 0
+#define LASVM_FLOAT  1
+lasvm_t *lasvm_create_precision( lasvm_kcache_t *cache, int sumflag, 
+                                 double cp, double cn, int precision );
+int lasvm_get_precision( lasvm_t *self );
+
 /* --- lasvm_destroy
    Deallocates a lasvm object. 
    The associated kernel cache must be deallocated separately. 
 */
 void lasvm_destroy( lasvm_t *self );
 
+/* --- lasvm_linear_dot_t, lasvm_linear_update_t
+   Callbacks maintaining an explicit weight vector w for the linear kernel.
+   A <lasvm_linear_dot_t> returns the dot product of w with example <i>.
+   A <lasvm_linear_update_t> adds <a> times example <i> to w.
+   Argument <closure> represents arbitrary additional information.
+*/
+typedef double (*lasvm_linear_dot_t)(unsigned long i, void *closure);
+typedef void (*lasvm_linear_update_t)(unsigned long i, double a, void *closure);
+
+/* --- lasvm_set_linear
+   Makes the solver report every coefficient change to <update>
+   and compute the gradients of new examples and the predictions
+   with <dot> instead of kernel rows. This is only valid for 
+   the linear kernel. Must be called before the first PROCESS
+   operation, while the weight vector is zero.
+   Only the gradient of a new example costs O(nnz) this way. Each
+   optimization step of PROCESS and REPROCESS still picks its pair
+   from the gradients of all support vectors, so it still reads
+   their kernel rows and updates all their gradients, in O(#SV).
+*/
+void lasvm_set_linear( lasvm_t *self, lasvm_linear_dot_t dot,
+                       lasvm_linear_update_t update, void *closure );
+
+/* --- lasvm_observer_t, lasvm_set_observer
+   Makes the solver report every coefficient change to <observer>:
+   <a> is added to the coefficient of example <i>. Unlike the linear
+   hooks this does not change how the solver computes anything.
+   Must be called before the first PROCESS operation, or be given
+   the current expansion by the caller. A null <observer> removes it.
+*/
+typedef void (*lasvm_observer_t)(unsigned long i, double a, void *closure);
+void lasvm_set_observer( lasvm_t *self, lasvm_observer_t observer, void *closure );
+
+/* --- lasvm_set_budget
+   Limits the number of support vectors to <maxsv>.
+   Zero, the default, means no limit. When a PROCESS operation
+   exceeds the limit, the support vector with the worst margin
+   is removed. When there is a bias, its coefficient is transferred to the nearest
+   support vectors whose box constraints can absorb it, so that the 
+   equality constraint still holds, and the next worst support vector
+   is removed instead when they cannot. Gradients are updated accordingly.
+   <lasvm_process_batch> enforces the limit after the whole batch.
+*/
+void lasvm_set_budget( lasvm_t *self, unsigned long maxsv );
+
 /* --- lasvm_get_l
    Returns the number of support vectors.
 */
@@ -40,6 +101,19 @@ unsigned long lasvm_get_l( lasvm_t *self );
 
 unsigned long lasvm_process( lasvm_t *self, unsigned long xi, double y );
 
+/* --- lasvm_process_batch
+   Performs the PROCESS operation on the <k> examples 
+   whose indices are in array <xi> and labels in array <y>.
+   The kernel values between the candidates, the current 
+   support vectors and the other candidates are computed
+   as one block (see <lasvm_kcache_query_block>) before 
+   the candidates are inserted in order. 
+   Returns the number of SVs if a change has been made.
+   Otherwise returns zero.
+*/
+unsigned long lasvm_process_batch( lasvm_t *self, unsigned long k, 
+                                   const unsigned long *xi, const double *y );
+
 /* --- lasvm_reprocess
    Performs the REPROCESS operation with a tolerance <epsgr>
    on the gradients. Returns the number of SVs if a change 
@@ -63,6 +137,17 @@ unsigned long lasvm_finish(lasvm_t *self, double epsgr);
 double lasvm_get_cp( lasvm_t *self );
 double lasvm_get_cn( lasvm_t *self );
 
+/* --- lasvm_set_c
+   Changes the values of parameter C for positive and
+   negative examples, keeping the current solution as a
+   warm start. Coefficients are clipped into the new box,
+   and when there is a bias the class with the larger sum
+   is scaled down until the equality constraint holds again.
+   Gradients are then recomputed through <lasvm_init>,
+   reusing the kernel cache. Call <lasvm_finish> afterwards.
+*/
+void lasvm_set_c( lasvm_t *self, double cp, double cn );
+
 /* --- lasvm_get_delta
    Returns the maximal gradient exploitable by a subsequent
    REPROCESS operation. Calling REPROCESS with <epsgr>
@@ -111,6 +196,16 @@ double lasvm_predict(lasvm_t *self, unsigned long xi);
 */
 double lasvm_predict_nocache(lasvm_t *self, unsigned long xi);
 
+/* --- lasvm_predict_batch
+   Computes the kernel expansion on the <n> examples whose
+   indices are in array <xi> and stores the results into
+   array <f>. The rows of the examples are computed together
+   (see <lasvm_kcache_query_rows>) and are kept in the cache
+   like those of <lasvm_predict>.
+*/
+void lasvm_predict_batch(lasvm_t *self, unsigned long n, 
+                         const unsigned long *xi, double *f);
+
 /* --- lasvm_init
    Resets the state of lasvm to known values.
    The gradients <g> are optional. 
@@ -127,4 +222,88 @@ void lasvm_init( lasvm_t *self, unsigned long l,
                  const double *alpha, 
                  const double *g );
 
+/* --- lasvm_save_state
+   Writes the complete state of the solver to <f> in binary form:
+   box constraints, coefficients, gradients, shrinking status and 
+   the examples occupying each position of the kernel cache.
+   Kernel values are not saved.
+*/
+void lasvm_save_state( lasvm_t *self, FILE *f );
+
+/* --- lasvm_load_state
+   Restores a state written by <lasvm_save_state> into an empty
+   solver created on a kernel cache over the same examples.
+   The parameters C and the budget are restored as well.
+   Linear hooks must be installed beforehand; the weight 
+   vector is rebuilt from the coefficients.
+*/
+void lasvm_load_state( lasvm_t *self, FILE *f );
+
+
+/* --- lasvm_snapshot_t, lasvm_publisher_t
+   A snapshot is an immutable copy of the kernel expansion 
+   (support vector indices, coefficients and bias).
+   A publisher holds the current snapshot of a solver and lets
+   prediction threads use it while another thread keeps training. 
+*/
+typedef struct lasvm_snapshot_s lasvm_snapshot_t;
+typedef struct lasvm_publisher_s lasvm_publisher_t;
+
+/* --- lasvm_publisher_create, lasvm_publisher_destroy
+   Creates a publisher without snapshot, and destroys it together
+   with its current snapshot. No reader may hold a snapshot
+   when the publisher is destroyed.
+*/
+lasvm_publisher_t *lasvm_publisher_create( void );
+void lasvm_publisher_destroy( lasvm_publisher_t *pub );
+
+/* --- lasvm_publish
+   Makes the current expansion of <self> the current snapshot of <pub>.
+   Must be called by the thread that trains <self>. Only the chunks
+   of positions modified since the previous call are copied; the others
+   are shared with the previous snapshot. The call then waits until
+   no reader holds the previous snapshot and frees it.
+   A solver must not be published through several publishers.
+*/
+void lasvm_publish( lasvm_publisher_t *pub, lasvm_t *self );
+
+/* --- lasvm_snapshot_acquire, lasvm_snapshot_release
+   Returns the current snapshot of <pub>, or a null pointer when
+   nothing has been published yet, and stores into <ticket> the
+   value to pass to <lasvm_snapshot_release> when done.
+   Readers never take a lock and never wait for the trainer.
+   Every acquire must be released, even when it returns null,
+   and the snapshot must not be used afterwards.
+*/
+const lasvm_snapshot_t *lasvm_snapshot_acquire( lasvm_publisher_t *pub, 
+                                                unsigned long *ticket );
+void lasvm_snapshot_release( lasvm_publisher_t *pub, unsigned long ticket );
+
+/* --- lasvm_snapshot_get_l, lasvm_snapshot_get_b, lasvm_snapshot_get_version
+   Return the number of support vectors, the bias and the number
+   of publications preceding snapshot <snap>.
+*/
+unsigned long lasvm_snapshot_get_l( const lasvm_snapshot_t *snap );
+double lasvm_snapshot_get_b( const lasvm_snapshot_t *snap );
+unsigned long lasvm_snapshot_get_version( const lasvm_snapshot_t *snap );
+
+/* --- lasvm_snapshot_get_sv, lasvm_snapshot_get_alpha
+   Copy the support vector indices and coefficients
+   of snapshot <snap> into arrays <sv> and <alpha>.
+*/
+unsigned long lasvm_snapshot_get_sv( const lasvm_snapshot_t *snap, unsigned long *sv );
+unsigned long lasvm_snapshot_get_alpha( const lasvm_snapshot_t *snap, double *alpha );
+
+/* --- lasvm_snapshot_predict
+   Computes the kernel expansion of snapshot <snap>, calling 
+   <kernel> with the index of each support vector and <closure>
+   to obtain its kernel value with the example to classify.
+   Returns the expansion minus the bias, like <lasvm_predict>.
+   The examples referenced by the snapshot must remain valid
+   as long as it is held.
+*/
+typedef double (*lasvm_snapshot_kernel_t)(unsigned long sv, void *closure);
+double lasvm_snapshot_predict( const lasvm_snapshot_t *snap, 
+                               lasvm_snapshot_kernel_t kernel, void *closure );
+
 #endif
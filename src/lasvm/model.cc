@@ -0,0 +1,69 @@
+#include <cstdio>
+#include <cstring>
+
+#include "model.hpp"
+
+int
+lasvm_model_write( const char *file_name, const lasvm_model_t *model )
+{
+  lasvm_model_header_t h;
+  uint64_t size[LASVM_MODEL_ARRAYS], position, start = 0;
+  const void *data[LASVM_MODEL_ARRAYS];
+  static const char zeros[LASVM_MODEL_ALIGN] = {0};
+  int k;
+  FILE *f;
+
+  memset(&h, 0, sizeof(h));
+  memcpy(h.magic, lasvm_model_magic, sizeof(lasvm_model_magic));
+  h.version = LASVM_MODEL_VERSION;
+  h.byte_order = lasvm_model_byte_order;
+  h.kernel_type = model->kernel_type;
+  h.multiclass_type = model->multiclass_type;
+  h.approximation = model->approximation;
+  h.degree = model->degree;
+  h.gamma = model->gamma;
+  h.coef0 = model->coef0;
+  h.number_of_classifiers = model->number_of_classifiers;
+  h.number_of_classes = model->number_of_classes;
+  h.number_of_sv = model->number_of_sv;
+  h.number_of_features = model->number_of_features;
+  h.number_of_weights = model->number_of_weights;
+  h.number_of_nonzeros = model->number_of_sv ? model->sv_start[model->number_of_sv] : 0;
+  h.approximation_dimension = model->approximation_dimension;
+  h.map_size = model->map ? model->map_size : 0;
+  if (lasvm_model_sizes(&h, size) != 0)
+    return -1;
+
+  data[0] = model->threshold;
+  data[1] = model->labels;
+  data[2] = model->number_of_sv ? model->sv_start : &start;
+  data[3] = model->sv_feature;
+  data[4] = model->sv_value;
+  data[5] = model->sv_square;
+  data[6] = model->alpha;
+  data[7] = model->w;
+  data[8] = model->map;
+  position = sizeof(h);
+  for (k=0; k<LASVM_MODEL_ARRAYS; k++)
+    {
+      position = (position + LASVM_MODEL_ALIGN - 1) / LASVM_MODEL_ALIGN * LASVM_MODEL_ALIGN;
+      h.offset[k] = position;
+      position += size[k];
+    }
+
+  f = fopen(file_name, "wb");
+  if (! f)
+    return -1;
+  fwrite(&h, sizeof(h), 1, f);
+  position = sizeof(h);
+  for (k=0; k<LASVM_MODEL_ARRAYS; k++)
+    {
+      fwrite(zeros, 1, h.offset[k] - position, f);
+      if (size[k] > 0)
+        fwrite(data[k], 1, size[k], f);
+      position = h.offset[k] + size[k];
+    }
+  if (ferror(f) || fclose(f) != 0)
+    return -1;
+  return 0;
+}
@@ -0,0 +1,285 @@
+#ifndef MODEL_H
+#define MODEL_H
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+/* ------------------------------------- */
+/* BINARY MODEL FILES */
+
+
+/* --- LASVM_MODEL_VERSION
+   Version of the binary model format written by <lasvm_model_write>.
+   Files with a larger version are rejected by <lasvm_model_map>.
+   The format is a fixed header followed by arrays of the native
+   byte order, each starting at a multiple of LASVM_MODEL_ALIGN
+   bytes, so that a mapped file is used in place without parsing.
+*/
+#define LASVM_MODEL_VERSION 1
+#define LASVM_MODEL_ALIGN   64
+
+/* --- lasvm_model_t
+   A trained model as a set of flat arrays. The arrays are owned by
+   the caller when writing, and point into the mapped file after
+   <lasvm_model_map>. Support vectors are stored as compressed rows:
+   the features of support vector <j> are <sv_feature[p]> with
+   values <sv_value[p]> for <sv_start[j]> <= p < <sv_start[j+1]>,
+   by increasing feature index. Linear models saved as weight
+   vectors have no support vectors and <number_of_weights> dense
+   rows of <number_of_features>+1 weights in <w>.
+*/
+typedef struct lasvm_model_s
+{
+  int kernel_type;                   /* kernel numbers of la_train */
+  int multiclass_type;
+  double degree, gamma, coef0;
+  unsigned long number_of_classifiers;
+  unsigned long number_of_classes;
+  unsigned long number_of_sv;
+  unsigned long number_of_features;  /* largest feature index */
+  unsigned long number_of_weights;
+  const double *threshold;           /* one per classifier */
+  const int32_t *labels;             /* one per class */
+  const uint64_t *sv_start;          /* number_of_sv + 1 */
+  const uint64_t *sv_feature;
+  const double *sv_value;
+  const double *sv_square;           /* squared norm of each support vector */
+  const double *alpha;               /* number_of_classifiers per support vector */
+  const double *w;
+  int approximation;                 /* feature map type, see approx.hpp */
+  unsigned long approximation_dimension;
+  const char *map;                   /* feature map as printed by lasvm_approx_print */
+  unsigned long map_size;
+  void *mapping;                     /* mapped file, 0 when writing */
+  unsigned long mapping_size;
+} lasvm_model_t;
+
+/* --- lasvm_model_header_t
+   Start of a binary model file. The arrays of <lasvm_model_t>,
+   in the order of their declaration, start at the byte offsets
+   <offset>. The support vectors hold <number_of_nonzeros> features.
+*/
+#define LASVM_MODEL_ARRAYS 9
+
+typedef struct lasvm_model_header_s
+{
+  char magic[8];                     /* LASVMBIN */
+  uint32_t version;
+  uint32_t byte_order;               /* 0x01020304 as written */
+  int32_t kernel_type;
+  int32_t multiclass_type;
+  int32_t approximation;
+  int32_t unused;
+  double degree, gamma, coef0;
+  uint64_t number_of_classifiers;
+  uint64_t number_of_classes;
+  uint64_t number_of_sv;
+  uint64_t number_of_features;
+  uint64_t number_of_weights;
+  uint64_t number_of_nonzeros;
+  uint64_t approximation_dimension;
+  uint64_t map_size;
+  uint64_t offset[LASVM_MODEL_ARRAYS];
+} lasvm_model_header_t;
+
+static const char lasvm_model_magic[8] = {'L','A','S','V','M','B','I','N'};
+static const uint32_t lasvm_model_byte_order = 0x01020304;
+
+/* product <a>*<b> into <r>, returns 1 on overflow */
+inline int
+lasvm_model_multiply( uint64_t a, uint64_t b, uint64_t *r )
+{
+  if (b != 0 && a > UINT64_MAX / b)
+    return 1;
+  *r = a * b;
+  return 0;
+}
+
+/* --- lasvm_model_sizes
+   Computes the size in bytes of each array of a binary model.
+   Returns 0 on success, -1 when a size does not fit 64 bits.
+*/
+inline int
+lasvm_model_sizes( const lasvm_model_header_t *h, uint64_t *size )
+{
+  uint64_t n;
+  if (h->number_of_sv == UINT64_MAX || h->number_of_features == UINT64_MAX)
+    return -1;
+  if (lasvm_model_multiply(h->number_of_classifiers, sizeof(double), &size[0])
+      || lasvm_model_multiply(h->number_of_classes, sizeof(int32_t), &size[1])
+      || lasvm_model_multiply(h->number_of_sv + 1, sizeof(uint64_t), &size[2])
+      || lasvm_model_multiply(h->number_of_nonzeros, sizeof(uint64_t), &size[3])
+      || lasvm_model_multiply(h->number_of_nonzeros, sizeof(double), &size[4])
+      || lasvm_model_multiply(h->number_of_sv, sizeof(double), &size[5])
+      || lasvm_model_multiply(h->number_of_sv, h->number_of_classifiers, &n)
+      || lasvm_model_multiply(n, sizeof(double), &size[6])
+      || lasvm_model_multiply(h->number_of_weights, h->number_of_features + 1, &n)
+      || lasvm_model_multiply(n, sizeof(double), &size[7]))
+    return -1;
+  size[8] = h->map_size;
+  return 0;
+}
+
+/* --- lasvm_model_check
+   Checks what the predictors index without bounds: the support
+   vectors are consecutive rows of features at most
+   <number_of_features>, and there is one classifier per pair of
+   classes for one-vs-one, one per class for one-vs-rest and one
+   for two classes, with at most as many weight rows.
+   Returns 0 when <model> is consistent, -2 otherwise.
+*/
+inline int
+lasvm_model_check( const lasvm_model_t *model )
+{
+  unsigned long j, K = model->number_of_classes, C = model->number_of_classifiers;
+  uint64_t p;
+  if (K < 2 || model->number_of_weights > C)
+    return -2;
+  if (K == 2 ? C != 1 : model->multiclass_type == 0 ? C != K : C != K*(K-1)/2)
+    return -2;
+  for (j=0; j<model->number_of_sv; j++)
+    if (model->sv_start[j] > model->sv_start[j+1])
+      return -2;
+  for (p=0; p<model->sv_start[model->number_of_sv]; p++)
+    if (model->sv_feature[p] > model->number_of_features)
+      return -2;
+  return 0;
+}
+
+/* --- lasvm_model_write
+   Writes <model> to file <file_name> in the binary format.
+   Returns 0 on success, -1 when the file cannot be written.
+*/
+int lasvm_model_write( const char *file_name, const lasvm_model_t *model );
+
+/* --- lasvm_model_is_binary
+   Returns 1 when file <file_name> starts like a binary model, 0 otherwise.
+*/
+inline int
+lasvm_model_is_binary( const char *file_name )
+{
+  char start[sizeof(lasvm_model_magic)];
+  FILE *f = fopen(file_name, "rb");
+  int binary;
+  if (! f)
+    return 0;
+  binary = fread(start, 1, sizeof(start), f) == sizeof(start) && ! memcmp(start, lasvm_model_magic, sizeof(lasvm_model_magic));
+  fclose(f);
+  return binary;
+}
+
+/* --- lasvm_model_map
+   Maps the binary model file <file_name> read-only into memory and
+   points the arrays of <model> into it. Returns 0 on success, -1 when
+   the file cannot be mapped, and -2 when it is not a binary model
+   of a supported version, has another byte order, is truncated, or
+   fails <lasvm_model_check>. The arrays are checked once here, so
+   that predictions index them without bounds checks.
+*/
+inline int
+lasvm_model_map( const char *file_name, lasvm_model_t *model )
+{
+  struct stat st;
+  const lasvm_model_header_t *h;
+  const char *base;
+  uint64_t size[LASVM_MODEL_ARRAYS];
+  void *mapping;
+  int k, fd;
+
+  fd = open(file_name, O_RDONLY);
+  if (fd < 0)
+    return -1;
+  if (fstat(fd, &st) != 0)
+    {
+      close(fd);
+      return -1;
+    }
+  if (st.st_size < static_cast<off_t>(sizeof(lasvm_model_header_t)))
+    {
+      close(fd);
+      return -2;
+    }
+  mapping = mmap(0, static_cast<size_t>(st.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (mapping == MAP_FAILED)
+    return -1;
+
+  base = static_cast<const char*>(mapping);
+  h = reinterpret_cast<const lasvm_model_header_t*>(base);
+  if (memcmp(h->magic, lasvm_model_magic, sizeof(lasvm_model_magic)) || h->version > LASVM_MODEL_VERSION
+      || h->byte_order != lasvm_model_byte_order)
+    {
+      munmap(mapping, static_cast<size_t>(st.st_size));
+      return -2;
+    }
+  if (lasvm_model_sizes(h, size) != 0)
+    {
+      munmap(mapping, static_cast<size_t>(st.st_size));
+      return -2;
+    }
+  for (k=0; k<LASVM_MODEL_ARRAYS; k++)
+    if (h->offset[k] % LASVM_MODEL_ALIGN || h->offset[k] > static_cast<uint64_t>(st.st_size)
+        || size[k] > static_cast<uint64_t>(st.st_size) - h->offset[k])
+      {
+        munmap(mapping, static_cast<size_t>(st.st_size));
+        return -2;
+      }
+  model->sv_start = reinterpret_cast<const uint64_t*>(base + h->offset[2]);
+  if (model->sv_start[0] != 0 || model->sv_start[h->number_of_sv] != h->number_of_nonzeros)
+    {
+      munmap(mapping, static_cast<size_t>(st.st_size));
+      return -2;
+    }
+
+  model->kernel_type = h->kernel_type;
+  model->multiclass_type = h->multiclass_type;
+  model->degree = h->degree;
+  model->gamma = h->gamma;
+  model->coef0 = h->coef0;
+  model->number_of_classifiers = h->number_of_classifiers;
+  model->number_of_classes = h->number_of_classes;
+  model->number_of_sv = h->number_of_sv;
+  model->number_of_features = h->number_of_features;
+  model->number_of_weights = h->number_of_weights;
+  model->threshold = reinterpret_cast<const double*>(base + h->offset[0]);
+  model->labels = reinterpret_cast<const int32_t*>(base + h->offset[1]);
+  model->sv_feature = reinterpret_cast<const uint64_t*>(base + h->offset[3]);
+  model->sv_value = reinterpret_cast<const double*>(base + h->offset[4]);
+  model->sv_square = reinterpret_cast<const double*>(base + h->offset[5]);
+  model->alpha = reinterpret_cast<const double*>(base + h->offset[6]);
+  model->w = reinterpret_cast<const double*>(base + h->offset[7]);
+  model->approximation = h->approximation;
+  model->approximation_dimension = h->approximation_dimension;
+  model->map = base + h->offset[8];
+  model->map_size = h->map_size;
+  model->mapping = mapping;
+  model->mapping_size = static_cast<unsigned long>(st.st_size);
+  if (lasvm_model_check(model) != 0)
+    {
+      munmap(mapping, static_cast<size_t>(st.st_size));
+      model->mapping = 0;
+      return -2;
+    }
+  return 0;
+}
+
+/* --- lasvm_model_unmap
+   Releases the file mapped by <lasvm_model_map>.
+   The arrays of <model> are no longer valid.
+*/
+inline void
+lasvm_model_unmap( lasvm_model_t *model )
+{
+  if (model->mapping)
+    munmap(model->mapping, model->mapping_size);
+  model->mapping = 0;
+  model->mapping_size = 0;
+}
+
+#endif
@@ -0,0 +1,142 @@
+#include <cmath>
+
+#include <map>
+#include <vector>
+
+#include "messages.hpp"
+#include "pool.hpp"
+
+struct lasvm_pool_s
+{
+  lasvm_t *svm;
+  lasvm_kcache_t *kernel;
+  std::vector<unsigned long> members;                   /* candidate examples */
+  std::vector<double> s;                                /* their expansion, without the bias */
+  std::map<unsigned long, double> alpha;                /* nonzero coefficients seen so far */
+  std::map<unsigned long, std::vector<double> > columns;/* kernel values of those with the candidates */
+};
+
+static void
+update(unsigned long i, double a, void *closure)
+{
+  lasvm_pool_t *self = (lasvm_pool_t*)closure;
+  unsigned long k, n = self->members.size();
+  std::map<unsigned long, std::vector<double> >::iterator column = self->columns.find(i);
+  double &alpha = self->alpha[i];
+  if (column == self->columns.end())
+    {
+      column = self->columns.insert(std::make_pair(i, std::vector<double>(n))).first;
+      if (n > 0)
+        lasvm_kcache_query_block(self->kernel, 1, &i, n, self->members.data(), column->second.data());
+    }
+  for (k=0; k<n; k++)
+    self->s[k] += a * column->second[k];
+  alpha += a;
+  /* the coefficient went back to zero up to rounding */
+  if (fabs(alpha) <= 1e-12 * fabs(a))
+    {
+      self->alpha.erase(i);
+      self->columns.erase(column);
+    }
+}
+
+lasvm_pool_t *
+lasvm_pool_create( lasvm_t *svm, lasvm_kcache_t *cache )
+{
+  lasvm_pool_t *self;
+  if (lasvm_get_l(svm) > 0)
+    lasvm_error("lasvm_pool_create(): the solver must be empty.\n");
+  self = new lasvm_pool_t;
+  self->svm = svm;
+  self->kernel = cache;
+  lasvm_set_observer(svm, update, self);
+  return self;
+}
+
+void
+lasvm_pool_destroy( lasvm_pool_t *self )
+{
+  lasvm_set_observer(self->svm, 0, 0);
+  delete self;
+}
+
+void
+lasvm_pool_add( lasvm_pool_t *self, unsigned long xi )
+{
+  unsigned long k, n = self->columns.size();
+  std::vector<unsigned long> sv;
+  std::vector<double> values(n);
+  std::map<unsigned long, std::vector<double> >::iterator column;
+  double s = 0;
+  for (column = self->columns.begin(); column != self->columns.end(); column++)
+    sv.push_back(column->first);
+  if (n > 0)
+    lasvm_kcache_query_block(self->kernel, n, sv.data(), 1, &xi, values.data());
+  for (k=0, column = self->columns.begin(); k<n; k++, column++)
+    {
+      column->second.push_back(values[k]);
+      s += self->alpha[sv[k]] * values[k];
+    }
+  self->members.push_back(xi);
+  self->s.push_back(s);
+}
+
+unsigned long
+lasvm_pool_remove( lasvm_pool_t *self, unsigned long k )
+{
+  unsigned long xi;
+  std::map<unsigned long, std::vector<double> >::iterator column;
+  if (k >= self->members.size())
+    lasvm_error("lasvm_pool_remove(): no such candidate.\n");
+  xi = self->members[k];
+  self->members[k] = self->members.back();
+  self->members.pop_back();
+  self->s[k] = self->s.back();
+  self->s.pop_back();
+  for (column = self->columns.begin(); column != self->columns.end(); column++)
+    {
+      column->second[k] = column->second.back();
+      column->second.pop_back();
+    }
+  return xi;
+}
+
+unsigned long
+lasvm_pool_get_size( lasvm_pool_t *self )
+{
+  return self->members.size();
+}
+
+unsigned long
+lasvm_pool_get_example( lasvm_pool_t *self, unsigned long k )
+{
+  return self->members[k];
+}
+
+double
+lasvm_pool_get_value( lasvm_pool_t *self, unsigned long k )
+{
+  return self->s[k] - lasvm_get_b(self->svm);
+}
+
+unsigned long
+lasvm_pool_select( lasvm_pool_t *self, int absolute )
+{
+  unsigned long k, best = 0, n = self->members.size();
+  double b = lasvm_get_b(self->svm);
+  double score, best_score = 0;
+  if (n == 0)
+    lasvm_error("lasvm_pool_select(): the pool is empty.\n");
+  for (k=0; k<n; k++)
+    {
+      score = self->s[k] - b;
+      if (absolute)
+        score = fabs(score);
+      if (k == 0 || score < best_score)
+        {
+          best = k;
+          best_score = score;
+        }
+    }
+  return best;
+}
@@ -0,0 +1,63 @@
+#ifndef POOL_H
+#define POOL_H
+
+#include "kcache.hpp"
+#include "lasvm.hpp"
+
+/* ------------------------------------- */
+/* CANDIDATE POOL FOR ACTIVE SELECTION */
+
+
+/* --- lasvm_pool_t
+   Opaque type for a set of candidate examples whose kernel
+   expansion is kept up to date as the solver coefficients change.
+   Every change of a coefficient adds a multiple of the kernel
+   column between its example and the candidates. Columns are
+   computed once per support vector and kept until its
+   coefficient returns to zero. Scoring the candidates then costs
+   nothing, and adding a candidate costs one kernel value per
+   support vector.
+*/
+typedef struct lasvm_pool_s lasvm_pool_t;
+
+/* --- lasvm_pool_create
+   Creates an empty pool and installs it as the observer of <svm>
+   (see <lasvm_set_observer>), which must not have support vectors
+   yet. Kernel values are queried from <cache>, the cache of <svm>,
+   without modifying it.
+*/
+lasvm_pool_t *lasvm_pool_create( lasvm_t *svm, lasvm_kcache_t *cache );
+
+/* --- lasvm_pool_destroy
+   Removes the pool from its solver and deallocates it.
+*/
+void lasvm_pool_destroy( lasvm_pool_t *self );
+
+/* --- lasvm_pool_add
+   Adds example <xi> to the candidates.
+*/
+void lasvm_pool_add( lasvm_pool_t *self, unsigned long xi );
+
+/* --- lasvm_pool_remove
+   Removes the candidate at position <k> and returns its example index.
+   The last candidate takes its position.
+*/
+unsigned long lasvm_pool_remove( lasvm_pool_t *self, unsigned long k );
+
+/* --- lasvm_pool_get_size, lasvm_pool_get_example, lasvm_pool_get_value
+   Return the number of candidates, and the example index and
+   the current decision value (see <lasvm_predict>) of the candidate
+   at position <k>.
+*/
+unsigned long lasvm_pool_get_size( lasvm_pool_t *self );
+unsigned long lasvm_pool_get_example( lasvm_pool_t *self, unsigned long k );
+double lasvm_pool_get_value( lasvm_pool_t *self, unsigned long k );
+
+/* --- lasvm_pool_select
+   Returns the position of the candidate with the smallest decision
+   value, or with the smallest absolute value when <absolute> is set.
+   The pool must not be empty.
+*/
+unsigned long lasvm_pool_select( lasvm_pool_t *self, int absolute );
+
+#endif
@@ -0,0 +1,309 @@
+#ifndef PREDICTOR_H
+#define PREDICTOR_H
+
+#include <cmath>
+#include <cstdint>
+#include <vector>
+
+#include "model.hpp"
+
+/* ------------------------------------- */
+/* EMBEDDABLE PREDICTOR */
+
+/* This header, with model.hpp, is all an application needs to
+   score examples with a binary model written by la_train -O 1 or
+   la_test -c -O 1. It does not link with the lasvm library;
+   la_predict (src/run/la_predict.cpp) is built from it alone. */
+
+
+/* --- lasvm_sparse_view_t
+   An example given by the caller: <size> features of indices
+   <index> and values <value>, by increasing index. The arrays are
+   not copied and must stay valid during the call.
+*/
+typedef struct lasvm_sparse_view_s
+{
+  const uint64_t *index;
+  const double *value;
+  unsigned long size;
+} lasvm_sparse_view_t;
+
+/* --- lasvm_xxx_kernel
+   Kernels of la_train, as the template parameter of <lasvm_predictor>.
+   Each computes k(x,y) from the dot product of x and y and their
+   squared norms, with the parameters read from the model.
+*/
+struct lasvm_linear_kernel
+{
+  enum { type = 0 };
+  lasvm_linear_kernel() {}
+  explicit lasvm_linear_kernel( const lasvm_model_t & ) {}
+  double operator()( double dot, double, double ) const { return dot; }
+};
+
+struct lasvm_poly_kernel
+{
+  enum { type = 1 };
+  double gamma, coef0, degree;
+  lasvm_poly_kernel() : gamma(1), coef0(0), degree(3) {}
+  explicit lasvm_poly_kernel( const lasvm_model_t &m ) : gamma(m.gamma), coef0(m.coef0), degree(m.degree) {}
+  double operator()( double dot, double, double ) const { return pow(gamma*dot+coef0, degree); }
+};
+
+struct lasvm_rbf_kernel
+{
+  enum { type = 2 };
+  double gamma;
+  lasvm_rbf_kernel() : gamma(1) {}
+  explicit lasvm_rbf_kernel( const lasvm_model_t &m ) : gamma(m.gamma) {}
+  double operator()( double dot, double x_sq, double y_sq ) const { return exp(-gamma*(x_sq+y_sq-2*dot)); }
+};
+
+struct lasvm_sigmoid_kernel
+{
+  enum { type = 3 };
+  double gamma, coef0;
+  lasvm_sigmoid_kernel() : gamma(1), coef0(0) {}
+  explicit lasvm_sigmoid_kernel( const lasvm_model_t &m ) : gamma(m.gamma), coef0(m.coef0) {}
+  double operator()( double dot, double, double ) const { return tanh(gamma*dot+coef0); }
+};
+
+/* --- lasvm_predictor
+   Decision values and labels of a model whose kernel is <Kernel>.
+   The model is read-only once loaded: the const methods may be
+   called from any number of threads at once, and allocate nothing.
+   <predict_batch> uses a <workspace> of the calling thread,
+   prepared once by <init_workspace>.
+*/
+template<typename Kernel>
+class lasvm_predictor
+{
+public:
+  static constexpr unsigned long TILE = 16; /* examples scored together by predict_batch */
+
+  struct workspace
+  {
+    std::vector<double> dense;       /* TILE examples interleaved by feature */
+    double x_square[TILE];
+  };
+
+  lasvm_predictor() : owned(false) { clear(); }
+  ~lasvm_predictor() { release(); }
+
+  /* --- load
+     Maps binary model file <file_name>. Returns 0 on success, -1 and
+     -2 as <lasvm_model_map>, and -3 when the model has another
+     kernel than <Kernel> or applies an explicit feature map.
+  */
+  int load( const char *file_name )
+  {
+    lasvm_model_t m;
+    int status;
+    release();
+    m.mapping = 0;
+    status = lasvm_model_map(file_name, &m);
+    if (status != 0)
+      return status;
+    status = attach(m);
+    if (status != 0)
+      {
+        lasvm_model_unmap(&m);
+        return status;
+      }
+    owned = true;
+    return 0;
+  }
+
+  /* --- attach
+     Uses the arrays of <m> in place, as <load> but without taking
+     ownership: they must outlive the predictor.
+  */
+  int attach( const lasvm_model_t &m )
+  {
+    release();
+    if (m.kernel_type != Kernel::type || m.approximation)
+      return -3;
+    model = m;
+    kernel = Kernel(m);
+    return 0;
+  }
+
+  unsigned long get_number_of_classifiers() const { return model.number_of_classifiers; }
+  unsigned long get_number_of_classes() const { return model.number_of_classes; }
+  unsigned long get_number_of_sv() const { return model.number_of_sv; }
+
+  /* --- predict
+     Computes the <get_number_of_classifiers()> decision values of <x>
+     into <f> and returns its label.
+  */
+  int predict( const lasvm_sparse_view_t &x, double *f ) const
+  {
+    unsigned long C = model.number_of_classifiers;
+    double x_sq = square(x);
+    start(x, f);
+    for (unsigned long j = 0; j < model.number_of_sv; j++)
+      {
+        /* merge of the two sorted index lists */
+        unsigned long p = model.sv_start[j], end = model.sv_start[j+1], q = 0;
+        double dot = 0;
+        while (p < end && q < x.size)
+          {
+            if (model.sv_feature[p] == x.index[q])
+              dot += model.sv_value[p++] * x.value[q++];
+            else if (model.sv_feature[p] < x.index[q])
+              p++;
+            else
+              q++;
+          }
+        double k = kernel(dot, x_sq, model.sv_square[j]);
+        const double *a = &model.alpha[j*C];
+        for (unsigned long c = 0; c < C; c++)
+          f[c] += a[c] * k;
+      }
+    return label(f);
+  }
+
+  /* --- init_workspace
+     Sizes <ws> for this model. Called once per thread after <load>.
+  */
+  void init_workspace( workspace &ws ) const
+  {
+    ws.dense.assign((model.number_of_features + 1) * TILE, 0.0);
+  }
+
+  /* --- predict_batch
+     Computes the decision values of the <n> examples <x> into the
+     rows of <f>, <get_number_of_classifiers()> values per example,
+     and their labels into <labels> unless null. Examples are scored
+     TILE at a time against each support vector, which reads the
+     support vectors once per tile instead of once per example.
+  */
+  void predict_batch( const lasvm_sparse_view_t *x, unsigned long n, double *f,
+                      workspace &ws, int *labels = 0 ) const
+  {
+    unsigned long C = model.number_of_classifiers;
+    for (unsigned long first = 0; first < n; first += TILE)
+      {
+        unsigned long m = n - first < TILE ? n - first : TILE;
+        tile(x + first, m, f + first*C, ws);
+        if (labels)
+          for (unsigned long t = 0; t < m; t++)
+            labels[first + t] = label(f + (first + t)*C);
+      }
+  }
+
+  /* --- label
+     Label of decision values <f>: the sign for two classes, the
+     largest value for one-vs-rest, the most votes for one-vs-one.
+  */
+  int label( const double *f ) const
+  {
+    unsigned long K = model.number_of_classes, best = 0;
+    if (K <= 2)
+      return (f[0] >= 0) ? model.labels[0] : model.labels[1];
+    if (model.multiclass_type == 0)
+      {
+        for (unsigned long c = 1; c < K; c++)
+          if (f[c] > f[best])
+            best = c;
+        return model.labels[best];
+      }
+    /* one-vs-one: classifier of classes c<d is number c*K-c*(c+1)/2+d-c-1 */
+    unsigned long best_votes = 0;
+    for (unsigned long c = 0; c < K; c++)
+      {
+        unsigned long votes = 0;
+        for (unsigned long d = 0; d < c; d++)
+          votes += f[d*K - d*(d+1)/2 + c-d-1] < 0;
+        for (unsigned long d = c + 1; d < K; d++)
+          votes += f[c*K - c*(c+1)/2 + d-c-1] >= 0;
+        if (votes > best_votes)
+          {
+            best_votes = votes;
+            best = c;
+          }
+      }
+    return model.labels[best];
+  }
+
+private:
+  lasvm_model_t model;
+  Kernel kernel;
+  bool owned;
+
+  lasvm_predictor( const lasvm_predictor & );
+  lasvm_predictor &operator=( const lasvm_predictor & );
+
+  void clear()
+  {
+    model = lasvm_model_t();
+    kernel = Kernel();
+  }
+
+  void release()
+  {
+    if (owned)
+      lasvm_model_unmap(&model);
+    owned = false;
+    clear();
+  }
+
+  static double square( const lasvm_sparse_view_t &x )
+  {
+    double s = 0;
+    for (unsigned long q = 0; q < x.size; q++)
+      s += x.value[q] * x.value[q];
+    return s;
+  }
+
+  /* thresholds and the weights of a linear model saved as w and b */
+  void start( const lasvm_sparse_view_t &x, double *f ) const
+  {
+    unsigned long C = model.number_of_classifiers, W = model.number_of_features + 1;
+    for (unsigned long c = 0; c < C; c++)
+      f[c] = -model.threshold[c];
+    for (unsigned long c = 0; c < model.number_of_weights; c++)
+      for (unsigned long q = 0; q < x.size; q++)
+        if (x.index[q] < W)
+          f[c] += model.w[c*W + x.index[q]] * x.value[q];
+  }
+
+  void tile( const lasvm_sparse_view_t *x, unsigned long n, double *f, workspace &ws ) const
+  {
+    unsigned long C = model.number_of_classifiers, W = model.number_of_features + 1;
+    double *dense = ws.dense.data();
+    double dot[TILE], k[TILE];
+    for (unsigned long t = 0; t < n; t++)
+      {
+        start(x[t], f + t*C);
+        ws.x_square[t] = square(x[t]);
+        for (unsigned long q = 0; q < x[t].size; q++)
+          if (x[t].index[q] < W)
+            dense[x[t].index[q]*TILE + t] = x[t].value[q];
+      }
+    for (unsigned long j = 0; j < model.number_of_sv; j++)
+      {
+        for (unsigned long t = 0; t < TILE; t++)
+          dot[t] = 0;
+        for (uint64_t p = model.sv_start[j]; p < model.sv_start[j+1]; p++)
+          {
+            const double v = model.sv_value[p];
+            const double *d = dense + model.sv_feature[p]*TILE;
+            for (unsigned long t = 0; t < TILE; t++)
+              dot[t] += v * d[t];
+          }
+        for (unsigned long t = 0; t < n; t++)
+          k[t] = kernel(dot[t], ws.x_square[t], model.sv_square[j]);
+        const double *a = &model.alpha[j*C];
+        for (unsigned long t = 0; t < n; t++)
+          for (unsigned long c = 0; c < C; c++)
+            f[t*C + c] += a[c] * k[t];
+      }
+    for (unsigned long t = 0; t < n; t++)   /* leave dense empty for the next tile */
+      for (unsigned long q = 0; q < x[t].size; q++)
+        if (x[t].index[q] < W)
+          dense[x[t].index[q]*TILE + t] = 0;
+  }
+};
+
+#endif
@@ -0,0 +1,77 @@
+#include <atomic>
+#include <chrono>
+
+#include "profile.hpp"
+
+const char *lasvm_phase_table[] = {"load","select","process","reprocess","finish",
+                                   "kernel","cache_fill","swap","save"};
+
+int lasvm_profile_flag = 0;
+
+static std::atomic<unsigned long long> calls[LASVM_PHASES];
+static std::atomic<unsigned long long> ticks[LASVM_PHASES];
+
+void
+lasvm_profile_enable( int on )
+{
+  lasvm_profile_flag = on;
+}
+
+unsigned long long
+lasvm_profile_ticks( void )
+{
+  /* nanoseconds, never zero so that zero means not measured */
+  return static_cast<unsigned long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+           std::chrono::steady_clock::now().time_since_epoch()).count()) | 1;
+}
+
+double
+lasvm_profile_now( void )
+{
+  return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void
+lasvm_profile_end( int phase, unsigned long long start )
+{
+  if (! start)
+    return;
+  ticks[phase].fetch_add(lasvm_profile_ticks() - start, std::memory_order_relaxed);
+  calls[phase].fetch_add(1, std::memory_order_relaxed);
+}
+
+unsigned long long
+lasvm_profile_get_calls( int phase )
+{
+  return calls[phase].load();
+}
+
+double
+lasvm_profile_get_time( int phase )
+{
+  return static_cast<double>(ticks[phase].load()) * 1e-9;
+}
+
+void
+lasvm_profile_reset( void )
+{
+  int p;
+  for (p=0; p<LASVM_PHASES; p++)
+    {
+      calls[p] = 0;
+      ticks[p] = 0;
+    }
+}
+
+void
+lasvm_profile_report( FILE *f )
+{
+  int p;
+  fprintf(f, "phase\tcalls\tseconds\tmean_us\n");
+  for (p=0; p<LASVM_PHASES; p++)
+    {
+      unsigned long long n = lasvm_profile_get_calls(p);
+      double t = lasvm_profile_get_time(p);
+      fprintf(f, "%s\t%llu\t%.6f\t%.3f\n", lasvm_phase_table[p], n, t, n ? t * 1e6 / n : 0.0);
+    }
+}
@@ -0,0 +1,86 @@
+#ifndef PROFILE_H
+#define PROFILE_H
+
+#include <cstdio>
+
+/* ------------------------------------- */
+/* WALL CLOCK PHASE PROFILER */
+
+
+/* --- LASVM_PHASE_xxx
+   Phases whose wall time and number of calls are recorded.
+   Phases nest: the time of a PROCESS operation includes the
+   kernel values it computes. Phases running on several threads
+   add up the time of every thread.
+*/
+#define LASVM_PHASE_LOAD      0
+#define LASVM_PHASE_SELECT    1
+#define LASVM_PHASE_PROCESS   2
+#define LASVM_PHASE_REPROCESS 3
+#define LASVM_PHASE_FINISH    4
+#define LASVM_PHASE_KERNEL    5
+#define LASVM_PHASE_FILL      6
+#define LASVM_PHASE_SWAP      7
+#define LASVM_PHASE_SAVE      8
+#define LASVM_PHASES          9
+
+extern const char *lasvm_phase_table[];
+
+/* --- lasvm_profile_enable
+   Starts (<on> nonzero) or stops recording. Recording is off by
+   default, and then costs one test per measured call.
+   Should not be called while other threads are measuring.
+*/
+void lasvm_profile_enable( int on );
+
+/* --- lasvm_profile_now
+   Returns the wall time in seconds since an arbitrary origin,
+   from a monotonic clock with sub-microsecond resolution.
+*/
+double lasvm_profile_now( void );
+
+/* --- lasvm_profile_begin, lasvm_profile_end
+   A measurement starts with <lasvm_profile_begin>, which returns
+   zero when recording is off, and ends with <lasvm_profile_end>
+   called with the phase and the returned value.
+*/
+extern int lasvm_profile_flag;
+unsigned long long lasvm_profile_ticks( void );
+void lasvm_profile_end( int phase, unsigned long long start );
+
+inline unsigned long long
+lasvm_profile_begin( void )
+{
+  return lasvm_profile_flag ? lasvm_profile_ticks() : 0;
+}
+
+/* --- lasvm_profile_scope
+   Measures <phase> from its construction to its destruction.
+*/
+struct lasvm_profile_scope
+{
+  int phase;
+  unsigned long long start;
+  explicit lasvm_profile_scope( int p ) : phase(p), start(lasvm_profile_begin()) {}
+  ~lasvm_profile_scope() { lasvm_profile_end(phase, start); }
+};
+
+/* --- lasvm_profile_get_calls, lasvm_profile_get_time
+   Return the number of calls and the total wall time in seconds
+   recorded for <phase>.
+*/
+unsigned long long lasvm_profile_get_calls( int phase );
+double lasvm_profile_get_time( int phase );
+
+/* --- lasvm_profile_reset
+   Clears the recorded calls and times.
+*/
+void lasvm_profile_reset( void );
+
+/* --- lasvm_profile_report
+   Writes one tab separated line per phase to <f>, after a header line:
+   phase name, calls, total seconds and mean microseconds per call.
+*/
+void lasvm_profile_report( FILE *f );
+
+#endif
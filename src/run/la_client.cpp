@@ -0,0 +1,187 @@
+#include <algorithm>
+#include <vector>
+#include <deque>
+#include <atomic>
+#include <thread>
+#include <mutex>
+
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <fstream>
+#include <string>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "../lasvm/profile.hpp"
+
+using namespace std;
+
+static unsigned long connections=8;      // concurrent clients
+static unsigned long depth=1;            // requests sent ahead of their answers by each client
+static unsigned long number_of_requests=0; // requests sent in total, 0=one per example
+static vector<string> lines;             // examples of the test set, sent as they are
+static vector<int> labels;               // their labels
+static mutex results_lock;
+static vector<double> latencies;         // seconds from sending each request to reading its answer
+static unsigned long long correct=0, answered=0, failed=0;
+
+[[noreturn]]void exit_with_help();
+FILE *open_socket(const char *socket_name, FILE **out);
+void run_client(const char *socket_name);
+void parse_command_line(int argc, char **argv, char *socket_name, char *input_file_name);
+
+[[noreturn]]void exit_with_help(){
+    cout << endl <<
+        "Usage: la_client [options] socket test_set_file" << endl <<
+        "Load generator of la_test -L: sends the examples of a libsvm file as requests and reports the latency" << endl <<
+        "of the answers, the throughput and the accuracy, then the counters of the server" << endl <<
+        "options:" << endl <<
+        "-c connections : number of concurrent clients (default 8)" << endl <<
+        "-d depth : requests each client sends ahead of their answers (default 1)" << endl <<
+        "-n requests : number of requests sent in total, cycling over the examples (default one per example)" << endl;
+    exit(EXIT_FAILURE);
+}
+
+
+FILE *open_socket(const char *socket_name, FILE **out){
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    strncpy(address.sun_path, socket_name, sizeof(address.sun_path) - 1);
+    int client = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(client < 0 || connect(client, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0){
+        cerr << "Could not connect to:" << socket_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    *out = fdopen(dup(client), "w");
+    return fdopen(client, "r");
+}
+
+
+void run_client(const char *socket_name){
+    // keeps <depth> requests in flight until all requests are sent and answered
+    static atomic<unsigned long> next(0);
+    FILE *out, *in = open_socket(socket_name, &out);
+    deque<pair<unsigned long, double> > sent;
+    vector<double> latency;
+    unsigned long long right = 0, wrong = 0;
+    char *line = NULL;
+    size_t size = 0;
+    for(;;){
+        unsigned long k;
+        while(sent.size() < depth && (k = next++) < number_of_requests){
+            fputs(lines[k % lines.size()].c_str(), out);
+            fputc('\n', out);
+            sent.push_back(make_pair(k % lines.size(), lasvm_profile_now()));
+        }
+        fflush(out);
+        if(sent.empty())
+            break;
+        if(getline(&line, &size, in) == -1){
+            cerr << "Connection closed by the server" << endl;
+            exit(EXIT_FAILURE);
+        }
+        latency.push_back(lasvm_profile_now() - sent.front().second);
+        if(strncmp(line, "error", 5) == 0)
+            wrong++;
+        else if(atoi(line) == labels[sent.front().first])
+            right++;
+        sent.pop_front();
+    }
+    free(line);
+    fclose(in);
+    fclose(out);
+    lock_guard<mutex> lock(results_lock);
+    latencies.insert(latencies.end(), latency.begin(), latency.end());
+    correct += right;
+    failed += wrong;
+    answered += latency.size();
+}
+
+
+void parse_command_line(int argc, char **argv, char *socket_name, char *input_file_name){
+    int i;
+    for(i=1;i<argc;i++){
+        if(argv[i][0] != '-')
+            break;
+        ++i;
+        if(i>=argc)
+            exit_with_help();
+        switch(argv[i-1][1]){
+            case 'c':
+                connections=max(1UL, stoul(argv[i]));
+                break;
+            case 'd':
+                depth=max(1UL, stoul(argv[i]));
+                break;
+            case 'n':
+                number_of_requests=stoul(argv[i]);
+                break;
+            default:
+                cerr << "Unknown option" << endl;
+                exit_with_help();
+        }
+    }
+    if(argc != i+2)
+        exit_with_help();
+    strncpy(socket_name, argv[i], 1023);
+    strncpy(input_file_name, argv[i+1], 1023);
+}
+
+
+int main(int argc, char **argv){
+    char socket_name[1024] = {'\0'};
+    char input_file_name[1024] = {'\0'};
+    parse_command_line(argc, argv, socket_name, input_file_name);
+
+    ifstream input(input_file_name);
+    if(!input.is_open()){
+        cerr << "Could not load file:" << input_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    string line;
+    while(getline(input, line))
+        if(line.find_first_not_of(" \t\r") != string::npos){
+            lines.push_back(line);
+            labels.push_back(atoi(line.c_str()));
+        }
+    if(lines.empty()){
+        cerr << "No example in:" << input_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    if(number_of_requests == 0)
+        number_of_requests = lines.size();
+
+    double start = lasvm_profile_now();
+    vector<thread> clients;
+    for(unsigned long c = 0; c < connections; c++)
+        clients.push_back(thread(run_client, socket_name));
+    for(unsigned long c = 0; c < connections; c++)
+        clients[c].join();
+    double elapsed = lasvm_profile_now() - start;
+
+    sort(latencies.begin(), latencies.end());
+    cout << "Requests = " << answered << " in " << elapsed << " s, throughput = " << static_cast<double>(answered) / elapsed << "/s" << endl;
+    if(!latencies.empty())
+        cout << "Latency p50 = " << latencies[(latencies.size() - 1) / 2] * 1e6 << " us, p99 = "
+             << latencies[(latencies.size() - 1) * 99 / 100] * 1e6 << " us" << endl;
+    cout << "Accuracy = " << correct << "/" << answered << "=" << (answered ? 100.0 * static_cast<double>(correct) / static_cast<double>(answered) : 0) << endl;
+    if(failed)
+        cout << "Errors = " << failed << endl;
+
+    FILE *out, *in = open_socket(socket_name, &out);
+    char *reply = NULL;
+    size_t size = 0;
+    fputs("stats\n", out);
+    fflush(out);
+    if(getline(&reply, &size, in) != -1)
+        cout << "Server: " << reply;
+    free(reply);
+    fclose(in);
+    fclose(out);
+}
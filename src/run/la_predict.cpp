@@ -0,0 +1,194 @@
+#include <algorithm>
+#include <vector>
+#include <thread>
+
+#include <cstring>
+#include <cstdio>
+#include <cstdlib>
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+
+#include "../lasvm/predictor.hpp"
+
+using namespace std;
+
+// Scores with lasvm_predictor alone: this file does not link with the lasvm library.
+
+#define BATCH 1024 // examples given to predict_batch at once
+
+static unsigned long threads=1;          // threads scoring batches of examples
+static bool write_values=false;          // write the decision values after each label
+
+struct example {
+    vector<uint64_t> index;
+    vector<double> value;
+};
+static vector<example> examples;         // the test set, features by increasing index
+static vector<int> labels;               // their labels
+
+[[noreturn]]void exit_with_help();
+void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name, char *output_file_name);
+void load_examples(const char *input_file_name);
+template<typename Kernel> void predict(const char *model_file_name, const char *output_file_name);
+
+[[noreturn]]void exit_with_help(){
+    cout << endl <<
+        "Usage: la_predict [options] test_set_file model_file output_file" << endl <<
+        "Predicts the labels of a libsvm file with a binary model (see la_train -O 1) through the" << endl <<
+        "header predictor.hpp, as an application embedding it would, and reports the accuracy" << endl <<
+        "options:" << endl <<
+        "-j threads : number of threads scoring batches of examples (default 1)" << endl <<
+        "-v values : write the decision values after each predicted label (default 0=off)" << endl;
+    exit(EXIT_FAILURE);
+}
+
+
+void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name, char *output_file_name){
+    int i;
+    for(i=1;i<argc;i++){
+        if(argv[i][0] != '-')
+            break;
+        ++i;
+        if(i>=argc)
+            exit_with_help();
+        switch(argv[i-1][1]){
+            case 'j':
+                threads=max(1UL, stoul(argv[i]));
+                break;
+            case 'v':
+                write_values=stoi(argv[i]) != 0;
+                break;
+            default:
+                cerr << "Unknown option" << endl;
+                exit_with_help();
+        }
+    }
+    if(argc != i+3)
+        exit_with_help();
+    strncpy(input_file_name, argv[i], 1023);
+    strncpy(model_file_name, argv[i+1], 1023);
+    strncpy(output_file_name, argv[i+2], 1023);
+}
+
+
+void load_examples(const char *input_file_name){
+    ifstream input(input_file_name);
+    if(!input.is_open()){
+        cerr << "Could not load file:" << input_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    string line;
+    while(getline(input, line)){
+        istringstream tokens(line);
+        string token;
+        if(!(tokens >> token))
+            continue;
+        example x;
+        labels.push_back(atoi(token.c_str()));
+        while(tokens >> token){
+            size_t colon = token.find(':');
+            if(colon == string::npos){
+                cerr << "Wrong input format in:" << input_file_name << endl;
+                exit(EXIT_FAILURE);
+            }
+            x.index.push_back(stoull(token.substr(0, colon)));
+            x.value.push_back(stod(token.substr(colon + 1)));
+        }
+        if(!is_sorted(x.index.begin(), x.index.end())){
+            cerr << "Features are not sorted by increasing index in:" << input_file_name << endl;
+            exit(EXIT_FAILURE);
+        }
+        examples.push_back(x);
+    }
+}
+
+
+template<typename Kernel> void predict(const char *model_file_name, const char *output_file_name){
+    lasvm_predictor<Kernel> predictor;
+    if(predictor.load(model_file_name) != 0){
+        cerr << "Could not load binary model:" << model_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    unsigned long n = examples.size(), C = predictor.get_number_of_classifiers();
+    vector<lasvm_sparse_view_t> x(n);
+    for(unsigned long i = 0; i < n; i++){
+        x[i].index = examples[i].index.data();
+        x[i].value = examples[i].value.data();
+        x[i].size = examples[i].index.size();
+    }
+    vector<double> f(n*C);
+    vector<int> predicted(n);
+    unsigned long batches = (n + BATCH - 1) / BATCH;
+    vector<thread> workers;
+    for(unsigned long t = 0; t < min(threads, batches); t++)
+        workers.push_back(thread([&, t](){
+            typename lasvm_predictor<Kernel>::workspace ws;
+            predictor.init_workspace(ws);
+            for(unsigned long b = t; b < batches; b += threads){
+                unsigned long first = b*BATCH;
+                predictor.predict_batch(&x[first], min<unsigned long>(BATCH, n - first), &f[first*C], ws, &predicted[first]);
+            }
+        }));
+    for(unsigned long t = 0; t < workers.size(); t++)
+        workers[t].join();
+
+    ofstream output(output_file_name);
+    if(!output.is_open()){
+        cerr << "Could not open :" << output_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    output.precision(17);
+    unsigned long correct = 0;
+    for(unsigned long i = 0; i < n; i++){
+        correct += predicted[i] == labels[i];
+        output << predicted[i];
+        for(unsigned long c = 0; write_values && c < C; c++)
+            output << " " << f[i*C + c];
+        output << '\n';
+    }
+    cout << "Accuracy = " << correct << "/" << n << "=" << (n ? 100.0 * correct / n : 0) << endl;
+}
+
+
+int main(int argc, char **argv){
+    char input_file_name[1024] = {'\0'};
+    char model_file_name[1024] = {'\0'};
+    char output_file_name[1024] = {'\0'};
+    parse_command_line(argc, argv, input_file_name, model_file_name, output_file_name);
+
+    lasvm_model_t model;
+    model.mapping = 0;
+    if(lasvm_model_map(model_file_name, &model) != 0){
+        cerr << "Could not load binary model:" << model_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    int kernel_type = model.kernel_type, approximation = model.approximation;
+    lasvm_model_unmap(&model);
+    if(approximation){
+        cerr << "Models with an explicit feature map need la_test" << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    load_examples(input_file_name);
+    switch(kernel_type){
+        case lasvm_linear_kernel::type:
+            predict<lasvm_linear_kernel>(model_file_name, output_file_name);
+            break;
+        case lasvm_poly_kernel::type:
+            predict<lasvm_poly_kernel>(model_file_name, output_file_name);
+            break;
+        case lasvm_rbf_kernel::type:
+            predict<lasvm_rbf_kernel>(model_file_name, output_file_name);
+            break;
+        case lasvm_sigmoid_kernel::type:
+            predict<lasvm_sigmoid_kernel>(model_file_name, output_file_name);
+            break;
+        default:
+            cerr << "Unknown kernel type in:" << model_file_name << endl;
+            exit(EXIT_FAILURE);
+    }
+    return 0;
+}
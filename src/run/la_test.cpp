@@ -2,25 +2,48 @@
 #include <algorithm>
 #include <vector>
 #include <map>
+#include <atomic>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <deque>
+#include <list>
 
 #include <cmath>
 #include <cstring>
 #include <cctype>
+#include <cstdio>
+#include <csignal>
+#include <cerrno>
+
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
 
 #include <iostream>
 #include <fstream>
 #include <string>
+#include <sstream>
 
 #include <boost/algorithm/string.hpp>
 
 #include "../lasvm/vector.hpp"
+#include "../lasvm/approx.hpp"
+#include "../lasvm/model.hpp"
+#include "../lasvm/profile.hpp"
 #include "../io/io.hpp"
+#include "../io/io_libsvm.hpp"
 
 #define LINEAR  0
 #define POLY    1
 #define RBF     2
 #define SIGMOID 3 
 
+#define ONE_VS_REST 0
+#define ONE_VS_ONE 1
+
+#define TILE 16 // test examples scored together against each support vector
+
 static const char *kernel_type_table[] = {"linear","polynomial","rbf","sigmoid"};
 
 using namespace std;
@@ -28,7 +51,11 @@ using namespace std;
 static map <unsigned long, lasvm_sparsevector_t> X; // feature vectors for test set
 static map <unsigned long, lasvm_sparsevector_t> Xsv;// feature vectors for SVs
 static map <unsigned long, int> Y;                   // labels
-static vector<double> alpha;            // alpha_i, SV weights
+static vector<double> alpha;            // alpha_i, SV weights, one per binary classifier for each SV
+static vector<int> labels;               // class labels, in model order
+static int multiclass_type=ONE_VS_REST;  // ONE_VS_REST or ONE_VS_ONE decomposition
+static vector<double> w;                 // weight vectors of a linear model saved as w and b, one dense row per classifier
+static lasvm_approx_t feature_map;       // explicit feature map of an approximated rbf kernel, applied before w
 static int use_threshold=1;                     // use threshold via constraint \sum a_i y_i =0
 static int kernel_type=RBF;              // LINEAR, POLY, RBF or SIGMOID kernels
 static double degree=3,kgamma=-1,coef0=0;// kernel params
@@ -36,30 +63,166 @@ static vector <double> x_square;         // norms of input vectors, used for RBF
 static vector <double> xsv_square;        // norms of test vectors, used for RBF
 static map<unsigned long, int> splits;
 static int is_binary = 0;
+static unsigned long threads=1;          // threads scoring tiles of test examples
+
+/* Support vectors of a text model in compressed sparse rows, for batch prediction */
+static vector<uint64_t> sv_start;        // position of the first feature of each SV, and the end
+static vector<uint64_t> sv_feature;      // feature indices
+static vector<double> sv_value;          // feature values
+static lasvm_model_t model;              // arrays of the text model, or of the mapped binary model
+static unsigned long dense_size = 0;     // one more than the largest SV feature
+
+/* Prediction server */
+#define LATENCIES 65536                  // latest latencies kept for the percentiles
+struct connection;
+struct request {
+    lasvm_sparsevector_t x;
+    double x_square;
+    vector<double> f;                    // decision values
+    string reply;                        // answer of requests that are not scored
+    double arrival;                      // wall time when parsed
+    bool done;
+    connection *owner;
+};
+struct connection {
+    deque<request*> pending;             // requests in arrival order, answered in that order
+    mutex lock;
+    condition_variable ready;
+    bool closed;
+};
+struct client {
+    thread reader;                       // runs serve_connection
+    int socket;
+    bool finished;                       // set before the socket is closed
+};
+static string server_name;               // unix socket of the server, - for the standard input and output
+static unsigned long batch_size=64;      // largest batch scored at once
+static double batch_window=500;          // microseconds a request may wait for its batch to fill
+static deque<request*> requests;         // requests waiting for a batch
+static mutex requests_lock;
+static condition_variable requests_ready;
+static mutex statistics_lock;
+static vector<double> latencies(LATENCIES);
+static unsigned long long served = 0, batches = 0;
+static double serve_start = 0;
+static volatile sig_atomic_t stopping = 0; // set by SIGINT and SIGTERM, stops accepting clients
+static bool draining = false;            // no more requests will come, the workers stop once the queue is empty
+static list<client> clients;             // connected clients, joined when finished or when the server stops
+static mutex clients_lock;
+
+/* Statistics */
+#define SCORE_BINS 65536                 // bins of the decision value histograms of the ranking metrics
+static int write_values=0;               // write the decision values after each label
+static int ranking=0;                    // ROC-AUC, PR-AUC and threshold sweep of two class problems
+static vector<double> sweep = {-1, -0.5, 0, 0.5, 1}; // thresholds of the sweep
+struct accumulator {                     // statistics of a set of examples, merged across threads
+    unsigned long number_of_instances;
+    double accuracy, false_positive, false_negative;
+    vector<unsigned long long> positive, negative; // histograms of the decision values of each class
+    vector<unsigned long long> positive_above, negative_above; // examples at or above each sweep threshold
+};
+
+/* Model compression */
+static double reduced_size=0;            // vectors kept by the reduced-set approximation, below 1 a fraction of the SVs, 0=off
+static int model_format=0;               // reduced model file as 0=text, 1=binary
+
+/* Streaming test */
+static unsigned long chunk_size=0;       // examples per chunk of a streamed test set, 0=load it whole
+struct chunk {
+    vector<lasvm_sparsevector_t> x;
+    vector<double> x_square;
+    vector<int> y;
+    vector<double> f;                    // decision values
+    bool done;
+};
+
+/* Early exit */
+static int early_exit=0;                 // stop the kernel sum of a two class model once its sign is settled
+static vector<unsigned long> sv_order;   // SVs by decreasing |alpha|
+static vector<double> remaining_alpha;   // sum of |alpha| over sv_order[j..]
+static vector<double> remaining_positive;// sum of the positive alpha over sv_order[j..], the rbf kernel lies in (0,1]
+static vector<double> remaining_norm;    // largest norm over sv_order[j..], bounds the linear and polynomial kernels
+static atomic<unsigned long long> evaluated_sv(0), bounded_instances(0);
+
+/* Inverted index */
+static int inverted_index=0;             // dot products from the postings of the features of each example
+static vector<uint64_t> index_start;     // position of the first posting of each feature, and the end
+static vector<unsigned long> index_sv;   // SV of each posting, increasing within a feature
+static vector<double> index_value;       // its feature value
 
 
 [[noreturn]]void exit_with_help();
-void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, double& threshold, double& degree,
-	double& kgamma, double& coef0, map<unsigned long, lasvm_sparsevector_t> Xsv, vector<double> xsv_square, vector<double> alpha);
-double kernel(int i, int j, void *kparam);
-void test(char *output_name, unsigned long number_of_instances, unsigned long number_of_sv, vector<double> alpha, map<unsigned long, int> Y, double threshold);
+void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, vector<double>& threshold, double& degree,
+	double& kgamma, double& coef0, map<unsigned long, lasvm_sparsevector_t>& Xsv, vector<double>& xsv_square, vector<double>& alpha);
+void binary_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, vector<double>& threshold);
+void pack_support_vectors(unsigned long number_of_sv, unsigned long number_of_features, const vector<double>& threshold);
+void predict_tile(const lasvm_sparsevector_t *const *x, const double *x_sq, unsigned long n, vector<double>& dense, double *f);
+void predict_block(const lasvm_sparsevector_t *const *x, const double *x_sq, unsigned long n, vector<double>& dense, double *f);
+void predict(unsigned long number_of_instances, vector<double>& f, accumulator& statistics);
+void order_support_vectors();
+bool settled(double f, unsigned long j, double x_norm);
+unsigned long predict_bounded(const lasvm_sparsevector_t& x, double x_sq, vector<double>& dense, double *f);
+void build_inverted_index();
+void predict_indexed(const lasvm_sparsevector_t& x, double x_sq, vector<double>& dot, double *f);
+unsigned long buffer_size();
+void serve_batches();
+void serve_connection(FILE *in, FILE *out);
+string serve_statistics();
+void serve(const string& name);
+int decision(const double *f);
+void init_accumulator(accumulator& a);
+void accumulate(accumulator& a, const double *f, int y);
+void merge_accumulators(accumulator& a, const accumulator& b);
+double early_exit_fraction();
+void print_statistics(const accumulator& a);
+void test(char *output_name, unsigned long number_of_instances, unsigned long number_of_classifiers);
+void test_stream(char *input_name, char *output_name, unsigned long number_of_classifiers);
+template<typename F> void run_parallel(unsigned long n, F job);
+double kernel_value(double dot, double x_sq, double y_sq);
+lasvm_sparsevector_t support_vector(unsigned long j);
+void save_model(char *model_file_name);
+void reduce(char *output_name, unsigned long number_of_instances);
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name, char *output_file_name);
 
 [[noreturn]]void exit_with_help(){
     cout << endl <<
 	    "Usage: la_test [options] test_set_file model_file output_file" << endl <<
+	    "       la_test -L socket [options] model_file" << endl <<
+	    "       la_test -c size [options] held_out_set_file model_file reduced_model_file" << endl <<
 	    "options:" << endl <<
             "-B file format : files are stored in the following format:" << endl <<
             "	0 -- libsvm ascii format (default)" << endl <<
             "	1 -- binary format" << endl <<
-            "	2 -- split file format" << endl; 
+            "	2 -- split file format" << endl <<
+            "-j threads : number of threads scoring tiles of test examples, or batches of requests (default 1)" << endl <<
+            "-L socket : serve predictions on a unix socket (- for the standard input and output) until interrupted;" << endl <<
+            " each request line is an example in libsvm format, its label is ignored, and is answered by a line" << endl <<
+            " with the predicted label and the decision values, in order; a line stats is answered by the counters" << endl <<
+            "-b batch : largest number of requests scored together (default 64)" << endl <<
+            "-w window : microseconds a request waits for its batch to fill (default 500)" << endl <<
+            "-s chunk : stream a libsvm test set (- for the standard input) in chunks of this many examples," << endl <<
+            " scored on -j threads while the next ones are read, in constant memory (default 0=load it whole)" << endl <<
+            "-v values : write the decision values after each predicted label (default 0=off)" << endl <<
+            "-r ranking : report the ROC-AUC, the PR-AUC and a threshold sweep of two class problems," << endl <<
+            " computed while predicting from histograms of the decision values (default 0=off)" << endl <<
+            "-t thresholds : comma separated thresholds of the sweep (default -1,-0.5,0,0.5,1)" << endl <<
+            "-c size : compress the model to this many vectors (below 1, a fraction of the SVs): keeps the SVs" << endl <<
+            " of largest weight and refits their weights to the full expansion, reports the error of the" << endl <<
+            " decision values on the held-out set and saves the reduced model" << endl <<
+            "-O format : reduced model file format, 0=text, 1=binary (default 0)" << endl <<
+            "-e early exit : for two class models, sum the SVs by decreasing |alpha| and stop once the rest" << endl <<
+            " cannot change the sign, reporting the fraction of SVs evaluated; the labels are unchanged," << endl <<
+            " the decision values are partial sums (default 0=off)" << endl <<
+            "-i index : compute the dot products with the SVs from an inverted index of their features, in time" << endl <<
+            " proportional to the features shared with each example, for sparse high dimensional data (default 0=off)" << endl <<
+            "model_file is a text or binary model, see la_train -O" << endl; 
 
     exit(EXIT_FAILURE);
 }
 
 
-void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, double& threshold, double& degree,
-							double& kgamma, double& coef0, map<unsigned long, lasvm_sparsevector_t> Xsv, vector<double> xsv_square, vector<double> alpha) {
+void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, vector<double>& threshold, double& degree,
+							double& kgamma, double& coef0, map<unsigned long, lasvm_sparsevector_t>& Xsv, vector<double>& xsv_square, vector<double>& alpha) {
 
 	  cout << "[Loading file: " << model_file_name << "...";
 
@@ -67,57 +230,124 @@ void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsig
 	  model.open(model_file_name);
 	  number_of_sv = 0;
 	  number_of_features = 0;
+	  threshold.clear();
+	  labels.clear();
 
 	  if (model.is_open()) {
 		  string buffer("");
-		  vector<string> strings, strings_;
-		  strings.clear();
-		  strings_.clear();
-		  while (*strings.begin() != "SV:") {
-			  getline(model,buffer);
-			  boost::split(strings, buffer, boost::is_any_of("\t "));
-			  if (strings[1] == "degree" || strings[1] == "degree=")
-				  degree = stod(*strings.end());
-			  else if (strings[1] == "gamma" || strings[1] == "gamma=")
-				  kgamma = stod(*strings.end());
-			  else if (strings[1] == "coef0" || strings[1] == "coef0=")
-				  coef0 = stod(*strings.end());
-			  else if (strings[1] == "Number of support vectors :" )
-				  number_of_sv = stoul(*strings.end());
-			  else if (strings[1] == "rho" || strings[1] == "rho=")
-				  threshold = stod(*strings.end());
+		  vector<string> strings;
+		  bool linear_weights = false;
+		  while (getline(model, buffer)) {
+			  boost::trim(buffer);
+			  if (buffer == "SV:")
+				  break;
+			  if (buffer == "W:") {
+				  linear_weights = true;
+				  break;
+			  }
+			  strings.clear();
+			  boost::split(strings, buffer, boost::is_any_of("\t :="), boost::token_compress_on);
+			  if (strings[0] == "Kernel_type") {
+				  for (int k = LINEAR; k <= SIGMOID; k++)
+					  if (strings[1] == kernel_type_table[k])
+						  kernel_type = k;
+			  }
+			  else if (strings[0] == "degree")
+				  degree = stod(strings.back());
+			  else if (strings[0] == "gamma")
+				  kgamma = stod(strings.back());
+			  else if (strings[0] == "coef0")
+				  coef0 = stod(strings.back());
+			  else if (strings[0] == "rho")
+				  for (unsigned long k = 1; k < strings.size(); k++)
+					  threshold.push_back(stod(strings[k]));
+			  else if (strings[0] == "Labels")
+				  for (unsigned long k = 1; k < strings.size(); k++)
+					  labels.push_back(stoi(strings[k]));
+			  else if (strings[0] == "Approximation" && strings.size() > 2) {
+				  for (int k = LASVM_APPROX_FOURIER; k <= LASVM_APPROX_NYSTROM; k++)
+					  if (strings[1] == lasvm_approx_table[k])
+						  feature_map.type = k;
+				  feature_map.dimension = stoul(strings[2]);
+			  }
+			  else if (strings[0] == "Multiclass")
+				  multiclass_type = (strings[1] == "one_vs_one") ? ONE_VS_ONE : ONE_VS_REST;
+			  else if (boost::starts_with(buffer, "Number of support vectors"))
+				  number_of_sv = stoul(strings.back());
+		  }
+		  if (labels.size() < 2) {
+			  labels.clear();
+			  labels.push_back(1);
+			  labels.push_back(-1);
 		  }
-		  strings.clear();
-		  strings_.clear();
+		  if (threshold.empty())
+			  threshold.push_back(0);
+		  unsigned long number_of_classifiers = threshold.size();
 
 		  lasvm_sparsevector_t feature_vector;
-		  int label = 0;
 		  unsigned long counter = 0;
 
 		  vector<string> features, features_;
-		  while (model.peek() != EOF) {
-			  label = 0;
+		  vector<lasvm_sparsevector_t> rows;
+		  alpha.clear();
+		  w.clear();
+		  while (linear_weights && rows.size() < number_of_classifiers && getline(model, buffer)) {
+			  boost::trim(buffer);
+			  features.clear();
+			  boost::split(features, buffer, boost::is_any_of("\t "), boost::token_compress_on);
+			  rows.push_back(lasvm_sparsevector_t());
+			  for (unsigned long iter = 0; iter < features.size(); iter++) {
+				  if (features[iter].empty())
+					  continue;
+				  features_.clear();
+				  boost::split(features_, features[iter], boost::is_any_of(":"));
+				  unsigned long attribute = stoul(features_[0]);
+				  rows.back()[attribute] = stod(features_[1]);
+				  if (number_of_features < attribute)
+					  number_of_features = attribute;
+			  }
+		  }
+		  w.assign(rows.size() * (number_of_features + 1), 0);
+		  for (unsigned long c = 0; c < rows.size(); c++)
+			  for (lasvm_sparsevector_t::iterator iter = rows[c].begin(); iter != rows[c].end(); iter++)
+				  w[c * (number_of_features + 1) + iter->first] = iter->second;
+		  if (feature_map.type != LASVM_APPROX_NONE) {
+			  feature_map.gamma = kgamma;
+			  while (getline(model, buffer) && boost::trim_copy(buffer) != "Map:")
+				  ;
+			  if (!lasvm_approx_read(feature_map, model)) {
+				  cerr << "Truncated feature map in " << model_file_name << endl;
+				  exit(EXIT_FAILURE);
+			  }
+		  }
+		  while (!linear_weights && getline(model, buffer)) {
+			  boost::trim(buffer);
+			  if (buffer.empty())
+				  continue;
 			  feature_vector.clear();
-
-			  getline(model, buffer);
 			  features.clear();
-			  features_.clear();
-			  boost::split(features, buffer, boost::is_any_of("\t "));
-			  label = stoi(features[0].c_str());
-			  for (unsigned long iter = 1; iter < features.size(); iter++) {
+			  boost::split(features, buffer, boost::is_any_of("\t "), boost::token_compress_on);
+			  for (unsigned long iter = 0; iter < number_of_classifiers; iter++)
+				  alpha.push_back(stod(features[iter]));
+			  for (unsigned long iter = number_of_classifiers; iter < features.size(); iter++) {
 				  features_.clear();
 				  boost::split(features_, features[iter], boost::is_any_of(":"));
 				  feature_vector[stoul(features_[0])] = stod(features_[1]);
 			  }
-			  if (number_of_features < feature_vector.rbegin()->first)
+			  if (!feature_vector.empty() && number_of_features < feature_vector.rbegin()->first)
 				  number_of_features = feature_vector.rbegin()->first;
 			  Xsv[counter] = feature_vector;
-			  alpha[counter] = label;
 			  counter++;
 		  }
 
-		  number_of_sv = min<unsigned long>(number_of_sv, counter);
-		  cout << " Number of support vectors: " << number_of_sv << ", number of features: " << number_of_features << " ]" << endl;
+		  number_of_sv = counter;
+		  if (kernel_type == RBF) {
+			  xsv_square.resize(number_of_sv);
+			  for (unsigned long j = 0; j < number_of_sv; j++)
+				  xsv_square[j] = lasvm_sparsevector_square(Xsv[j]);
+		  }
+		  cout << " Number of support vectors: " << number_of_sv << ", number of features: " << number_of_features 
+			   << ", number of classes: " << labels.size() << " ]" << endl;
 		  model.close();
 	  }
 	  else {
@@ -128,56 +358,598 @@ void libsvm_load_model(char* model_file_name, unsigned long& number_of_sv, unsig
 
 
 
-double kernel(int i, int j, void *kparam){
-    double dot;
-    dot=lasvm_sparsevector_dot_product(X[i],Xsv[j]);
-    
-    // sparse, linear kernel
+void binary_load_model(char* model_file_name, unsigned long& number_of_sv, unsigned long& number_of_features, vector<double>& threshold){
+    // maps the arrays of the model, only the small header values and the feature map are copied
+    cout << "[Loading file: " << model_file_name << "...";
+    int status = lasvm_model_map(model_file_name, &model);
+    if(status == -2){
+        cerr << "Invalid or unsupported binary model:" << model_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    else if(status != 0){
+        cerr << "Could not load file:" << model_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    kernel_type = model.kernel_type;
+    multiclass_type = model.multiclass_type;
+    degree = model.degree;
+    kgamma = model.gamma;
+    coef0 = model.coef0;
+    threshold.assign(model.threshold, model.threshold + model.number_of_classifiers);
+    labels.assign(model.labels, model.labels + model.number_of_classes);
+    number_of_sv = model.number_of_sv;
+    number_of_features = model.number_of_features;
+    dense_size = number_of_sv ? number_of_features + 1 : 0;
+    if(model.approximation != LASVM_APPROX_NONE){
+        istringstream map_text(string(model.map, model.map_size));
+        feature_map.type = model.approximation;
+        feature_map.dimension = model.approximation_dimension;
+        feature_map.gamma = kgamma;
+        if(!lasvm_approx_read(feature_map, map_text)){
+            cerr << "Truncated feature map in " << model_file_name << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    cout << " Number of support vectors: " << number_of_sv << ", number of features: " << number_of_features 
+         << ", number of classes: " << labels.size() << " ]" << endl;
+}
+
+
+void pack_support_vectors(unsigned long number_of_sv, unsigned long number_of_features, const vector<double>& threshold){
+    // moves the SVs of a text model into compressed rows, read sequentially by every tile,
+    // and points the model arrays to them
+    sv_start.assign(1, 0);
+    sv_feature.clear();
+    sv_value.clear();
+    dense_size = 0;
+    for(unsigned long j = 0; j < number_of_sv; j++){
+        const lasvm_sparsevector_t& x = Xsv.at(j);
+        for(lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++){
+            sv_feature.push_back(iter->first);
+            sv_value.push_back(iter->second);
+            dense_size = max(dense_size, iter->first + 1);
+        }
+        sv_start.push_back(sv_feature.size());
+    }
+    Xsv.clear();
+    model.number_of_classifiers = threshold.size();
+    model.threshold = threshold.data();
+    model.number_of_sv = number_of_sv;
+    model.number_of_features = number_of_features;
+    model.number_of_weights = w.size() / (number_of_features + 1);
+    model.sv_start = sv_start.data();
+    model.sv_feature = sv_feature.data();
+    model.sv_value = sv_value.data();
+    model.sv_square = xsv_square.data();
+    model.alpha = alpha.data();
+    model.w = w.data();
+}
+
+
+void predict_tile(const lasvm_sparsevector_t *const *x, const double *x_sq, unsigned long n, vector<double>& dense, double *f){
+    // decision values of the n examples x (at most TILE), x_sq their squared norms for RBF, f holds one row per example.
+    // The examples are scattered into dense, interleaved by feature, so that each SV
+    // feature updates the dot products of the whole tile with one contiguous loop.
+    unsigned long C = model.number_of_classifiers, W = model.number_of_features + 1;
+    const uint64_t *sv_start = model.sv_start, *sv_feature = model.sv_feature;
+    const double *sv_value = model.sv_value;
+    double dot[TILE], k[TILE];
+    for(unsigned long t = 0; t < n; t++){
+        for(unsigned long c = 0; c < C; c++)
+            f[t*C + c] = -model.threshold[c];
+        for(unsigned long c = 0; c < model.number_of_weights; c++) // linear model saved as w and b
+            for(lasvm_sparsevector_t::const_iterator iter = x[t]->begin(); iter != x[t]->end(); iter++)
+                if(iter->first < W)
+                    f[t*C + c] += model.w[c*W + iter->first]*iter->second;
+        for(lasvm_sparsevector_t::const_iterator iter = x[t]->begin(); iter != x[t]->end(); iter++)
+            if(iter->first < dense_size)
+                dense[iter->first*TILE + t] = iter->second;
+    }
+    for(unsigned long j = 0; j < model.number_of_sv; j++){
+        for(unsigned long t = 0; t < TILE; t++)
+            dot[t] = 0;
+        for(unsigned long p = sv_start[j]; p < sv_start[j+1]; p++){
+            const double v = sv_value[p];
+            const double *d = &dense[sv_feature[p]*TILE];
+            for(unsigned long t = 0; t < TILE; t++)
+                dot[t] += v * d[t];
+        }
+        switch(kernel_type){
+        case LINEAR:
+            for(unsigned long t = 0; t < n; t++)
+                k[t] = dot[t];
+            break;
+        case POLY:
+            for(unsigned long t = 0; t < n; t++)
+                k[t] = pow(kgamma*dot[t]+coef0,degree);
+            break;
+        case RBF:
+            for(unsigned long t = 0; t < n; t++)
+                k[t] = exp(-kgamma*(x_sq[t]+model.sv_square[j]-2*dot[t]));
+            break;
+        case SIGMOID:
+            for(unsigned long t = 0; t < n; t++)
+                k[t] = tanh(kgamma*dot[t]+coef0);
+            break;
+        }
+        const double *a = &model.alpha[j*C];
+        for(unsigned long t = 0; t < n; t++) // kernel values are shared by all binary classifiers
+            for(unsigned long c = 0; c < C; c++)
+                f[t*C + c] += a[c]*k[t];
+    }
+    for(unsigned long t = 0; t < n; t++) // leave dense empty for the next tile
+        for(lasvm_sparsevector_t::const_iterator iter = x[t]->begin(); iter != x[t]->end(); iter++)
+            if(iter->first < dense_size)
+                dense[iter->first*TILE + t] = 0;
+}
+
+
+void predict_block(const lasvm_sparsevector_t *const *x, const double *x_sq, unsigned long n, vector<double>& dense, double *f){
+    // decision values of any number of examples, one tile after the other
+    unsigned long C = model.number_of_classifiers;
+    if(early_exit){
+        unsigned long long evaluated = 0;
+        for(unsigned long k = 0; k < n; k++)
+            evaluated += predict_bounded(*x[k], x_sq ? x_sq[k] : 0, dense, f + k*C);
+        evaluated_sv += evaluated;
+        bounded_instances += n;
+        return;
+    }
+    if(inverted_index){
+        for(unsigned long k = 0; k < n; k++)
+            predict_indexed(*x[k], x_sq ? x_sq[k] : 0, dense, f + k*C);
+        return;
+    }
+    for(unsigned long first = 0; first < n; first += TILE)
+        predict_tile(x + first, x_sq ? x_sq + first : NULL, min<unsigned long>(TILE, n - first), dense, f + first*C);
+}
+
+
+void predict(unsigned long number_of_instances, vector<double>& f, accumulator& statistics){
+    // scores the tiles on the threads, each with its own dense buffer and statistics
+    unsigned long C = model.number_of_classifiers;
+    unsigned long tiles = (number_of_instances + TILE - 1) / TILE;
+    atomic<unsigned long> next(0);
+    mutex statistics_lock;
+    f.resize(number_of_instances * C);
+    init_accumulator(statistics);
+    auto worker = [&](){
+        vector<double> dense(buffer_size(), 0);
+        const lasvm_sparsevector_t *x[TILE];
+        accumulator local;
+        init_accumulator(local);
+        for(unsigned long k = next++; k < tiles; k = next++){
+            unsigned long n = min<unsigned long>(TILE, number_of_instances - k*TILE);
+            for(unsigned long t = 0; t < n; t++)
+                x[t] = &X.at(k*TILE + t);
+            predict_block(x, kernel_type == RBF ? &x_square[k*TILE] : NULL, n, dense, &f[k*TILE*C]);
+            for(unsigned long t = 0; t < n; t++)
+                accumulate(local, &f[(k*TILE + t)*C], Y.at(k*TILE + t));
+        }
+        lock_guard<mutex> lock(statistics_lock);
+        merge_accumulators(statistics, local);
+    };
+    vector<thread> workers;
+    for(unsigned long t = 1; t < min(threads, tiles); t++)
+        workers.push_back(thread(worker));
+    worker();
+    for(unsigned long t = 0; t < workers.size(); t++)
+        workers[t].join();
+}
+
+
+void order_support_vectors(){
+    // sorts the SVs by decreasing |alpha| so that the largest terms of the kernel sum come first,
+    // and sums the weights and the largest norms of the SVs left after each position
+    unsigned long l = model.number_of_sv;
+    vector<double> norm(l, 0);
+    for(unsigned long j = 0; j < l; j++){
+        for(uint64_t p = model.sv_start[j]; p < model.sv_start[j+1]; p++)
+            norm[j] += model.sv_value[p]*model.sv_value[p];
+        norm[j] = sqrt(norm[j]);
+    }
+    sv_order.resize(l);
+    for(unsigned long j = 0; j < l; j++)
+        sv_order[j] = j;
+    stable_sort(sv_order.begin(), sv_order.end(), [](unsigned long a, unsigned long b){ return fabs(model.alpha[a]) > fabs(model.alpha[b]); });
+    remaining_alpha.assign(l + 1, 0);
+    remaining_positive.assign(l + 1, 0);
+    remaining_norm.assign(l + 1, 0);
+    for(unsigned long j = l; j-- > 0; ){
+        remaining_alpha[j] = remaining_alpha[j+1] + fabs(model.alpha[sv_order[j]]);
+        remaining_positive[j] = remaining_positive[j+1] + max(model.alpha[sv_order[j]], 0.0);
+        remaining_norm[j] = max(remaining_norm[j+1], norm[sv_order[j]]);
+    }
+}
+
+
+bool settled(double f, unsigned long j, double x_norm){
+    // true when adding the kernel sum over sv_order[j..] to f cannot change its sign: the rbf kernel
+    // lies in (0,1], the sigmoid kernel in [-1,1], and |x.y| <= |x||y| bounds the others
     switch(kernel_type){
     case LINEAR:
-        return dot; 
+        return fabs(f) > remaining_alpha[j]*x_norm*remaining_norm[j];
     case POLY:
-	return pow(kgamma*dot+coef0,degree);
+        return fabs(f) > remaining_alpha[j]*pow(fabs(kgamma)*x_norm*remaining_norm[j]+fabs(coef0),degree);
     case RBF:
-	return exp(-kgamma*(x_square[i]+xsv_square[j]-2*dot));    
-    case SIGMOID:
-	return tanh(kgamma*dot+coef0);    
+        return f - (remaining_alpha[j] - remaining_positive[j]) >= 0 || f + remaining_positive[j] < 0;
     }
-    return 0;
-}  
+    return fabs(f) > remaining_alpha[j];
+}
+
+
+unsigned long predict_bounded(const lasvm_sparsevector_t& x, double x_sq, vector<double>& dense, double *f){
+    // decision value of a two class model summed until the SVs left cannot change its sign,
+    // returns the number of SVs evaluated; x is scattered into the first slot of the tile buffer
+    unsigned long W = model.number_of_features + 1, j;
+    double x_norm = 0;
+    f[0] = -model.threshold[0];
+    for(lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++){
+        if(model.number_of_weights > 0 && iter->first < W)
+            f[0] += model.w[iter->first]*iter->second;
+        if(iter->first < dense_size)
+            dense[iter->first*TILE] = iter->second;
+        x_norm += iter->second*iter->second;
+    }
+    x_norm = sqrt(x_norm);
+    for(j = 0; j < model.number_of_sv && !settled(f[0], j, x_norm); j++){
+        unsigned long s = sv_order[j];
+        double dot = 0;
+        for(uint64_t p = model.sv_start[s]; p < model.sv_start[s+1]; p++)
+            dot += model.sv_value[p]*dense[model.sv_feature[p]*TILE];
+        f[0] += model.alpha[s]*kernel_value(dot, x_sq, kernel_type == RBF ? model.sv_square[s] : 0);
+    }
+    for(lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+        if(iter->first < dense_size)
+            dense[iter->first*TILE] = 0;
+    return j;
+}
+
+
+void build_inverted_index(){
+    // postings of each feature, the SVs having it and their values, grouped by feature with a counting sort
+    unsigned long l = model.number_of_sv;
+    uint64_t nonzeros = l ? model.sv_start[l] : 0;
+    index_start.assign(dense_size + 1, 0);
+    for(uint64_t p = 0; p < nonzeros; p++)
+        index_start[model.sv_feature[p] + 1]++;
+    for(unsigned long i = 0; i < dense_size; i++)
+        index_start[i+1] += index_start[i];
+    vector<uint64_t> next(index_start.begin(), index_start.end() - 1);
+    index_sv.resize(nonzeros);
+    index_value.resize(nonzeros);
+    for(unsigned long j = 0; j < l; j++)
+        for(uint64_t p = model.sv_start[j]; p < model.sv_start[j+1]; p++){
+            uint64_t q = next[model.sv_feature[p]]++;
+            index_sv[q] = j;
+            index_value[q] = model.sv_value[p];
+        }
+}
+
+
+void predict_indexed(const lasvm_sparsevector_t& x, double x_sq, vector<double>& dot, double *f){
+    // decision values of x: each feature of x adds to the dot products of the SVs in its postings,
+    // dot holds one value per SV and is left zero
+    unsigned long C = model.number_of_classifiers, W = model.number_of_features + 1;
+    for(unsigned long c = 0; c < C; c++)
+        f[c] = -model.threshold[c];
+    for(unsigned long c = 0; c < model.number_of_weights; c++) // linear model saved as w and b
+        for(lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+            if(iter->first < W)
+                f[c] += model.w[c*W + iter->first]*iter->second;
+    for(lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+        if(iter->first < dense_size)
+            for(uint64_t q = index_start[iter->first]; q < index_start[iter->first + 1]; q++)
+                dot[index_sv[q]] += index_value[q]*iter->second;
+    for(unsigned long j = 0; j < model.number_of_sv; j++){
+        double k = kernel_value(dot[j], x_sq, kernel_type == RBF ? model.sv_square[j] : 0);
+        const double *a = &model.alpha[j*C];
+        for(unsigned long c = 0; c < C; c++)
+            f[c] += a[c]*k;
+        dot[j] = 0;
+    }
+}
+
+
+unsigned long buffer_size(){
+    // doubles of the buffer of each thread: a tile of dense examples, or one dot product per SV
+    return inverted_index ? model.number_of_sv : dense_size * TILE;
+}
   
 
-void test(char *output_name, unsigned long number_of_instances, unsigned long number_of_sv, vector<double> alpha, map<unsigned long, int> Y, double threshold){	
+void serve_batches(){
+    // worker of the server: waits for a full batch, or for the window of its oldest request to end,
+    // and scores it in tiles, until the server stops and no request is left
+    vector<double> dense(buffer_size(), 0);
+    vector<request*> batch;
+    vector<const lasvm_sparsevector_t*> x;
+    vector<double> x_sq, f;
+    unsigned long C = model.number_of_classifiers;
+    for(;;){
+        batch.clear();
+        {
+            unique_lock<mutex> lock(requests_lock);
+            requests_ready.wait(lock, [](){ return !requests.empty() || draining; });
+            if(requests.empty())
+                return;
+            double deadline = requests.front()->arrival + batch_window * 1e-6;
+            while(!requests.empty() && requests.size() < batch_size && lasvm_profile_now() < deadline)
+                requests_ready.wait_for(lock, chrono::duration<double>(deadline - lasvm_profile_now()));
+            while(!requests.empty() && batch.size() < batch_size){
+                batch.push_back(requests.front());
+                requests.pop_front();
+            }
+        }
+        x.resize(batch.size());
+        x_sq.resize(batch.size());
+        f.resize(batch.size() * C);
+        for(unsigned long k = 0; k < batch.size(); k++){
+            x[k] = &batch[k]->x;
+            x_sq[k] = batch[k]->x_square;
+        }
+        predict_block(x.data(), x_sq.data(), batch.size(), dense, f.data());
+        for(unsigned long k = 0; k < batch.size(); k++)
+            batch[k]->f.assign(&f[k*C], &f[k*C] + C);
+        double now = lasvm_profile_now();
+        {
+            lock_guard<mutex> lock(statistics_lock);
+            for(unsigned long k = 0; k < batch.size(); k++)
+                latencies[(served + k) % LATENCIES] = now - batch[k]->arrival;
+            served += batch.size();
+            batches += batch.empty() ? 0 : 1;
+        }
+        for(unsigned long k = 0; k < batch.size(); k++){
+            lock_guard<mutex> lock(batch[k]->owner->lock);
+            batch[k]->done = true;
+            batch[k]->owner->ready.notify_one();
+        }
+    }
+}
+
+
+void serve_connection(FILE *in, FILE *out){
+    // the calling thread reads the requests of one client, a second thread answers them in order
+    connection c;
+    c.closed = false;
+    thread writer([&](){
+        for(;;){
+            request *r;
+            bool flush;
+            {
+                unique_lock<mutex> lock(c.lock);
+                c.ready.wait(lock, [&](){ return (!c.pending.empty() && c.pending.front()->done) || (c.closed && c.pending.empty()); });
+                if(c.pending.empty())
+                    break;
+                r = c.pending.front();
+                c.pending.pop_front();
+                flush = c.pending.empty() || !c.pending.front()->done; // write answers ready together at once
+            }
+            if(r->reply.empty()){
+                fprintf(out, "%d", decision(r->f.data()));
+                for(unsigned long k = 0; k < r->f.size(); k++)
+                    fprintf(out, " %.17g", r->f[k]);
+                fprintf(out, "\n");
+            }
+            else
+                fprintf(out, "%s\n", r->reply.c_str());
+            if(flush)
+                fflush(out);
+            delete r;
+        }
+    });
+    char *line = NULL;
+    size_t size = 0;
+    int label;
+    while(getline(&line, &size, in) != -1){
+        request *r = new request;
+        istringstream stream(line);
+        r->owner = &c;
+        r->done = true;
+        if(boost::trim_copy(string(line)) == "stats")
+            r->reply = serve_statistics();
+        else {
+            try {
+                if(libsvm_read_instance(stream, label, r->x)){
+                    if(feature_map.type != LASVM_APPROX_NONE)
+                        r->x = lasvm_approx_apply(feature_map, r->x);
+                    r->x_square = (kernel_type == RBF) ? lasvm_sparsevector_square(r->x) : 0;
+                    r->arrival = lasvm_profile_now();
+                    r->done = false;
+                }
+                else
+                    r->reply = "error empty request";
+            }
+            catch(const exception&){
+                r->reply = "error invalid request";
+            }
+        }
+        bool queued = !r->done; // once pushed, an answered request may be deleted by the writer
+        {
+            lock_guard<mutex> lock(c.lock);
+            c.pending.push_back(r);
+            if(r->done)
+                c.ready.notify_one();
+        }
+        if(queued){
+            lock_guard<mutex> lock(requests_lock);
+            requests.push_back(r);
+            requests_ready.notify_one();
+        }
+    }
+    free(line);
+    {
+        lock_guard<mutex> lock(c.lock);
+        c.closed = true;
+        c.ready.notify_one();
+    }
+    writer.join();
+}
+
+
+string serve_statistics(){
+    // requests served, batches, throughput since the start, and percentiles of the latest latencies
+    vector<double> latest;
+    unsigned long long n, b;
+    {
+        lock_guard<mutex> lock(statistics_lock);
+        n = served;
+        b = batches;
+        latest.assign(latencies.begin(), latencies.begin() + static_cast<long>(min<unsigned long long>(n, LATENCIES)));
+    }
+    sort(latest.begin(), latest.end());
+    double p50 = latest.empty() ? 0 : latest[(latest.size() - 1) / 2];
+    double p99 = latest.empty() ? 0 : latest[(latest.size() - 1) * 99 / 100];
+    double elapsed = lasvm_profile_now() - serve_start;
+    ostringstream statistics;
+    statistics << "requests " << n << " batches " << b << " mean_batch " << (b ? static_cast<double>(n) / static_cast<double>(b) : 0)
+               << " throughput " << static_cast<double>(n) / elapsed << " p50_us " << p50 * 1e6 << " p99_us " << p99 * 1e6;
+    if(early_exit)
+        statistics << " sv_fraction " << early_exit_fraction();
+    return statistics.str();
+}
+
+
+static void stop_serving(int){
+    stopping = 1;
+}
+
+
+void serve(const string& name){
+    // one thread per client, -j workers scoring the batches
+    serve_start = lasvm_profile_now();
+    vector<thread> workers;
+    for(unsigned long t = 0; t < threads; t++)
+        workers.push_back(thread(serve_batches));
+    auto stop_workers = [&](){
+        {
+            lock_guard<mutex> lock(requests_lock);
+            draining = true;
+            requests_ready.notify_all();
+        }
+        for(unsigned long t = 0; t < workers.size(); t++)
+            workers[t].join();
+    };
+    if(name == "-"){
+        serve_connection(stdin, stdout);
+        stop_workers();
+        cerr << serve_statistics() << endl;
+        return;
+    }
+
+    sockaddr_un address;
+    memset(&address, 0, sizeof(address));
+    address.sun_family = AF_UNIX;
+    if(name.size() >= sizeof(address.sun_path)){
+        cerr << "Socket name too long:" << name << endl;
+        exit(EXIT_FAILURE);
+    }
+    strncpy(address.sun_path, name.c_str(), sizeof(address.sun_path) - 1);
+    unlink(name.c_str());
+    int listening = socket(AF_UNIX, SOCK_STREAM, 0);
+    if(listening < 0 || ::bind(listening, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 || listen(listening, 128) != 0){
+        cerr << "Could not listen on:" << name << endl;
+        exit(EXIT_FAILURE);
+    }
+    struct sigaction action;
+    memset(&action, 0, sizeof(action));
+    action.sa_handler = stop_serving; // without SA_RESTART so that accept returns
+    sigaction(SIGINT, &action, NULL);
+    sigaction(SIGTERM, &action, NULL);
+    signal(SIGPIPE, SIG_IGN);
+    cout << "Serving on " << name << endl;
+
+    while(!stopping){
+        int fd = accept(listening, NULL, NULL);
+        if(fd < 0){
+            if(errno == EINTR)
+                continue;
+            cerr << "Could not accept a client on:" << name << endl;
+            break;
+        }
+        FILE *in = fdopen(fd, "r"), *out = fdopen(dup(fd), "w");
+        lock_guard<mutex> lock(clients_lock);
+        for(list<client>::iterator c = clients.begin(); c != clients.end(); )
+            if(c->finished){
+                c->reader.join();
+                c = clients.erase(c);
+            }
+            else
+                c++;
+        clients.push_back(client());
+        client& c = clients.back();
+        c.socket = fd;
+        c.finished = false;
+        c.reader = thread([&c, in, out](){
+            serve_connection(in, out);
+            {
+                lock_guard<mutex> lock(clients_lock);
+                c.finished = true;
+            }
+            fclose(in);
+            fclose(out);
+        });
+    }
+    close(listening);
+    unlink(name.c_str());
+    // clients still connected read no more requests, their queued requests are answered before the workers stop
+    {
+        lock_guard<mutex> lock(clients_lock);
+        for(list<client>::iterator c = clients.begin(); c != clients.end(); c++)
+            if(!c->finished)
+                shutdown(c->socket, SHUT_RD);
+    }
+    for(list<client>::iterator c = clients.begin(); c != clients.end(); c++)
+        c->reader.join();
+    clients.clear();
+    stop_workers();
+    cout << serve_statistics() << endl;
+}
+
+
+int decision(const double *f){
+    // sign for two classes, largest output for one-vs-rest, most votes for one-vs-one
+	unsigned long best = 0;
+	if (labels.size() <= 2)
+		return (f[0] >= 0) ? labels[0] : labels[1];
+
+	if (multiclass_type == ONE_VS_REST) {
+		for (unsigned long c = 1; c < labels.size(); c++)
+			if (f[c] > f[best])
+				best = c;
+		return labels[best];
+	}
+
+	vector<unsigned long> votes(labels.size(), 0);
+	unsigned long k = 0;
+	for (unsigned long c = 0; c < labels.size(); c++)
+		for (unsigned long d = c + 1; d < labels.size(); d++, k++)
+			votes[(f[k] >= 0) ? c : d]++;
+	for (unsigned long c = 1; c < labels.size(); c++)
+		if (votes[c] > votes[best])
+			best = c;
+	return labels[best];
+}
+
+
+void test(char *output_name, unsigned long number_of_instances, unsigned long number_of_classifiers){	
     ofstream output_file ( output_name );
-    double label_pred = -threshold;
-    double accuracy=0;
-	double false_positive = 0;
-	double false_negative = 0;
 
     if( output_file.is_open() ){
+        vector<double> decision_values;
+        accumulator statistics;
+        predict(number_of_instances, decision_values, statistics);
 
+        output_file.precision(17);
         for(unsigned long i = 0; i < number_of_instances ; i++){
-            for(unsigned long j=0 ; j < number_of_sv ; j++)
-                label_pred+=alpha[j]*kernel(i,j,NULL);
-
-            if(label_pred >= 0) 
-                label_pred = 1;
-            else 
-                label_pred = -1;
-			output_file << label_pred << endl;
-
-			if (static_cast<int>(label_pred) == Y[i])
-				accuracy++;
-			else if (static_cast<int>(label_pred) == 1)
-				false_positive++;
-			else
-				false_negative++;
+            const double *f = &decision_values[i*number_of_classifiers];
+			output_file << decision(f);
+			for(unsigned long c = 0; write_values && c < number_of_classifiers; c++)
+				output_file << " " << f[c];
+			output_file << '\n';
         }
 
         output_file.close();
-		cout << "Accuracy = " << accuracy << "/" << number_of_instances << "=" << accuracy / number_of_instances * 100 << endl <<
-			"False postive rate = " << false_positive << "/" << number_of_instances << "=" << false_positive / number_of_instances * 100 << endl <<
-			"False postive rate = " << false_negative << "/" << number_of_instances << "=" << false_negative / number_of_instances * 100 << endl;
+		print_statistics(statistics);
     }
 	else {
 		cerr << "Could not open :" << output_name << endl;
@@ -186,19 +958,524 @@ void test(char *output_name, unsigned long number_of_instances, unsigned long nu
 }
 
 
+void init_accumulator(accumulator& a){
+    a.number_of_instances = 0;
+    a.accuracy = a.false_positive = a.false_negative = 0;
+    if(ranking && labels.size() == 2){
+        a.positive.assign(SCORE_BINS, 0);
+        a.negative.assign(SCORE_BINS, 0);
+        a.positive_above.assign(sweep.size(), 0);
+        a.negative_above.assign(sweep.size(), 0);
+    }
+}
+
+
+void accumulate(accumulator& a, const double *f, int y){
+    // counts an example of label y with decision values f
+    int label_pred = decision(f);
+    a.number_of_instances++;
+    if (label_pred == y)
+        a.accuracy++;
+    else if (label_pred == labels[0])
+        a.false_positive++;
+    else
+        a.false_negative++;
+    if(!a.positive.empty()){ // f/(1+|f|) keeps the order of the decision values and maps them into (-1,1)
+        double u = f[0] / (1 + fabs(f[0]));
+        long bin = min<long>(SCORE_BINS - 1, max<long>(0, static_cast<long>((u + 1) / 2 * SCORE_BINS)));
+        vector<unsigned long long>& histogram = (y == labels[0]) ? a.positive : a.negative;
+        vector<unsigned long long>& above = (y == labels[0]) ? a.positive_above : a.negative_above;
+        histogram[static_cast<unsigned long>(bin)]++;
+        for(unsigned long k = 0; k < sweep.size(); k++)
+            if(f[0] >= sweep[k])
+                above[k]++;
+    }
+}
+
+
+void merge_accumulators(accumulator& a, const accumulator& b){
+    a.number_of_instances += b.number_of_instances;
+    a.accuracy += b.accuracy;
+    a.false_positive += b.false_positive;
+    a.false_negative += b.false_negative;
+    for(unsigned long k = 0; k < a.positive.size(); k++){
+        a.positive[k] += b.positive[k];
+        a.negative[k] += b.negative[k];
+    }
+    for(unsigned long k = 0; k < a.positive_above.size(); k++){
+        a.positive_above[k] += b.positive_above[k];
+        a.negative_above[k] += b.negative_above[k];
+    }
+}
+
+
+double early_exit_fraction(){
+    // average fraction of the SVs evaluated per example by the early exit
+    unsigned long long n = bounded_instances;
+    return (n && model.number_of_sv) ? static_cast<double>(evaluated_sv) / static_cast<double>(n) / static_cast<double>(model.number_of_sv) : 0;
+}
+
+
+void print_statistics(const accumulator& a){
+		double n = static_cast<double>(a.number_of_instances);
+		cout << "Accuracy = " << a.accuracy << "/" << n << "=" << a.accuracy / n * 100 << endl;
+		if (labels.size() == 2)
+			cout << "False positive rate = " << a.false_positive << "/" << n << "=" << a.false_positive / n * 100 << endl <<
+				"False negative rate = " << a.false_negative << "/" << n << "=" << a.false_negative / n * 100 << endl;
+		if (early_exit)
+			cout << "Support vectors evaluated = " << early_exit_fraction() * 100 << "% on average" << endl;
+		if (a.positive.empty())
+			return;
+
+		// from the highest scores down, examples sharing a bin count as ties
+		double P = 0, N = 0, tp = 0, fp = 0, roc = 0, pr = 0;
+		for (unsigned long k = 0; k < SCORE_BINS; k++) {
+			P += static_cast<double>(a.positive[k]);
+			N += static_cast<double>(a.negative[k]);
+		}
+		for (unsigned long k = SCORE_BINS; k-- > 0; ) {
+			double p = static_cast<double>(a.positive[k]), q = static_cast<double>(a.negative[k]);
+			roc += q * (tp + p / 2);
+			tp += p;
+			fp += q;
+			if (p > 0)
+				pr += p * tp / (tp + fp);
+		}
+		if (P > 0 && N > 0)
+			cout << "ROC-AUC = " << roc / (P * N) << endl << "PR-AUC = " << pr / P << endl;
+		else
+			cout << "ROC-AUC and PR-AUC need examples of both classes" << endl;
+		for (unsigned long k = 0; k < sweep.size(); k++) {
+			double above = static_cast<double>(a.positive_above[k] + a.negative_above[k]);
+			cout << "Threshold = " << sweep[k] << ": true positive rate = " << (P > 0 ? static_cast<double>(a.positive_above[k]) / P : 0)
+				 << ", false positive rate = " << (N > 0 ? static_cast<double>(a.negative_above[k]) / N : 0)
+				 << ", precision = " << (above > 0 ? static_cast<double>(a.positive_above[k]) / above : 0) << endl;
+		}
+}
+
+
+void test_stream(char *input_name, char *output_name, unsigned long number_of_classifiers){
+    // this thread reads chunks, -j workers score them and a writer writes them in input order;
+    // at most two chunks per worker are alive, so memory does not grow with the test set
+    ifstream input_file;
+    if(strcmp(input_name, "-") != 0){
+        input_file.open(input_name);
+        if(!input_file.is_open()){
+            cerr << "Could not load file:" << input_name << endl;
+            exit(EXIT_FAILURE);
+        }
+    }
+    istream& input = (strcmp(input_name, "-") != 0) ? input_file : cin;
+    ofstream output_file(output_name);
+    if(!output_file.is_open()){
+        cerr << "Could not open :" << output_name << endl;
+        exit(EXIT_FAILURE);
+    }
+
+    deque<chunk*> order;                 // chunks alive, in input order
+    deque<chunk*> unscored;              // chunks waiting for a worker
+    mutex lock;
+    condition_variable changed;
+    bool finished = false;
+    accumulator statistics;
+    init_accumulator(statistics);
+
+    vector<thread> workers;
+    for(unsigned long t = 0; t < threads; t++)
+        workers.push_back(thread([&](){
+            vector<double> dense(buffer_size(), 0);
+            vector<const lasvm_sparsevector_t*> x;
+            accumulator local;
+            init_accumulator(local);
+            for(;;){
+                chunk *c;
+                {
+                    unique_lock<mutex> guard(lock);
+                    changed.wait(guard, [&](){ return !unscored.empty() || finished; });
+                    if(unscored.empty()){
+                        merge_accumulators(statistics, local);
+                        return;
+                    }
+                    c = unscored.front();
+                    unscored.pop_front();
+                }
+                x.resize(c->x.size());
+                for(unsigned long k = 0; k < c->x.size(); k++)
+                    x[k] = &c->x[k];
+                c->f.resize(c->x.size() * number_of_classifiers);
+                predict_block(x.data(), c->x_square.data(), c->x.size(), dense, c->f.data());
+                for(unsigned long k = 0; k < c->x.size(); k++)
+                    accumulate(local, &c->f[k*number_of_classifiers], c->y[k]);
+                lock_guard<mutex> guard(lock);
+                c->done = true;
+                changed.notify_all();
+            }
+        }));
+    thread writer([&](){
+        output_file.precision(17);
+        for(;;){
+            chunk *c;
+            {
+                unique_lock<mutex> guard(lock);
+                changed.wait(guard, [&](){ return (!order.empty() && order.front()->done) || (finished && order.empty()); });
+                if(order.empty())
+                    return;
+                c = order.front();
+                order.pop_front();
+                changed.notify_all();
+            }
+            for(unsigned long i = 0; i < c->x.size(); i++){
+                const double *f = &c->f[i*number_of_classifiers];
+                output_file << decision(f);
+                for(unsigned long k = 0; write_values && k < number_of_classifiers; k++)
+                    output_file << " " << f[k];
+                output_file << '\n';
+            }
+            delete c;
+        }
+    });
+
+    bool more = true;
+    unsigned long read = 0;
+    while(more){
+        chunk *c = new chunk;
+        int label;
+        lasvm_sparsevector_t x;
+        c->done = false;
+        try {
+            while(c->x.size() < chunk_size && (more = libsvm_read_instance(input, label, x))){
+                if(feature_map.type != LASVM_APPROX_NONE)
+                    x = lasvm_approx_apply(feature_map, x);
+                c->x.push_back(x);
+                c->y.push_back(label);
+                c->x_square.push_back((kernel_type == RBF) ? lasvm_sparsevector_square(x) : 0);
+                read++;
+            }
+        }
+        catch(const exception&){
+            cerr << "Invalid example after example " << read << " of " << input_name << endl;
+            exit(EXIT_FAILURE);
+        }
+        if(c->x.empty()){
+            delete c;
+            break;
+        }
+        unique_lock<mutex> guard(lock);
+        changed.wait(guard, [&](){ return order.size() < 2 * threads; });
+        order.push_back(c);
+        unscored.push_back(c);
+        changed.notify_all();
+    }
+    {
+        lock_guard<mutex> guard(lock);
+        finished = true;
+        changed.notify_all();
+    }
+    for(unsigned long t = 0; t < workers.size(); t++)
+        workers[t].join();
+    writer.join();
+    output_file.close();
+    print_statistics(statistics);
+}
+
+
+template<typename F> void run_parallel(unsigned long n, F job){
+    // workers pick the next job index until all <n> jobs are done
+	atomic<unsigned long> next(0);
+	vector<thread> workers;
+	unsigned long number_of_workers = min<unsigned long>(threads, n);
+	for (unsigned long w=0; w < number_of_workers; w++)
+		workers.push_back(thread([&](){
+			for (unsigned long k = next++; k < n; k = next++)
+				job(k);
+		}));
+	for (unsigned long w=0; w < number_of_workers; w++)
+		workers[w].join();
+}
+
+
+double kernel_value(double dot, double x_sq, double y_sq){
+    switch(kernel_type){
+    case LINEAR:
+        return dot;
+    case POLY:
+        return pow(kgamma*dot+coef0,degree);
+    case RBF:
+        return exp(-kgamma*(x_sq+y_sq-2*dot));
+    case SIGMOID:
+        return tanh(kgamma*dot+coef0);
+    }
+    return 0;
+}
+
+
+lasvm_sparsevector_t support_vector(unsigned long j){
+    lasvm_sparsevector_t x;
+    for(uint64_t p = model.sv_start[j]; p < model.sv_start[j+1]; p++)
+        x.insert(x.end(), make_pair(static_cast<unsigned long>(model.sv_feature[p]), model.sv_value[p]));
+    return x;
+}
+
+
+void save_model(char *model_file_name){
+    // writes the SV model in the text format of la_train, or in the binary format
+    if(model_format == 1){
+        if(lasvm_model_write(model_file_name, &model) != 0){
+            cerr << "Could not open file:" << model_file_name << endl;
+            exit(EXIT_FAILURE);
+        }
+        return;
+    }
+    ofstream output(model_file_name);
+    if(!output.is_open()){
+        cerr << "Could not open file:" << model_file_name << endl;
+        exit(EXIT_FAILURE);
+    }
+    unsigned long C = model.number_of_classifiers;
+    output << "Svm_type: C_svc" << endl;
+    output << "Kernel_type: " << kernel_type_table[kernel_type] << endl;
+    if (kernel_type == POLY)
+        output << "degree = " << degree << endl;
+    if (kernel_type == POLY || kernel_type == RBF || kernel_type == SIGMOID)
+        output << "gamma = " << kgamma << endl;
+    if (kernel_type == POLY || kernel_type == SIGMOID)
+        output << "coef0 = " << coef0 << endl;
+    output << "Number of classes: " << labels.size() << endl;
+    if (labels.size() > 2)
+        output << "Multiclass: " << (multiclass_type == ONE_VS_ONE ? "one_vs_one" : "one_vs_rest") << endl;
+    output << "Number of support vectors: " << model.number_of_sv << endl;
+    output << "rho =";
+    for (unsigned long c = 0; c < C; c++)
+        output << " " << model.threshold[c];
+    output << endl << "Labels:";
+    for (unsigned long c = 0; c < labels.size(); c++)
+        output << " " << labels[c];
+    output << endl;
+    output.precision(17);
+    output << "SV:" << endl;
+    for (unsigned long j = 0; j < model.number_of_sv; j++){
+        for (unsigned long c = 0; c < C; c++)
+            output << (c ? " " : "") << model.alpha[j*C + c];
+        output << lasvm_sparsevector_print(support_vector(j));
+    }
+}
+
+
+void reduce(char *output_name, unsigned long number_of_instances){
+    // reduced-set approximation: keeps the m SVs z of largest weight sum_c |alpha_c| sqrt(k(x,x)) and
+    // refits their weights beta to the projection of the full expansion, K_zz beta = K_zx alpha
+    unsigned long l = model.number_of_sv, C = model.number_of_classifiers;
+    if(l == 0 || feature_map.type != LASVM_APPROX_NONE){
+        cerr << "Only models with support vectors can be reduced" << endl;
+        exit(EXIT_FAILURE);
+    }
+    unsigned long m = (reduced_size < 1) ? static_cast<unsigned long>(ceil(reduced_size * static_cast<double>(l)))
+                                         : static_cast<unsigned long>(reduced_size);
+    m = min(max(m, 1UL), l);
+
+    vector<double> square(l), importance(l);
+    for(unsigned long j = 0; j < l; j++){
+        for(uint64_t p = model.sv_start[j]; p < model.sv_start[j+1]; p++)
+            square[j] += model.sv_value[p] * model.sv_value[p];
+        for(unsigned long c = 0; c < C; c++)
+            importance[j] += fabs(model.alpha[j*C + c]);
+        importance[j] *= sqrt(fabs(kernel_value(square[j], square[j], square[j])));
+    }
+    vector<unsigned long> kept(l);
+    for(unsigned long j = 0; j < l; j++)
+        kept[j] = j;
+    partial_sort(kept.begin(), kept.begin() + static_cast<long>(m), kept.end(),
+                 [&](unsigned long a, unsigned long b){ return importance[a] > importance[b]; });
+    kept.resize(m);
+    sort(kept.begin(), kept.end());
+
+    // right hand sides: the expansion at the kept SVs, scored in tiles by the full model
+    vector<lasvm_sparsevector_t> z(m);
+    vector<const lasvm_sparsevector_t*> pointers(m);
+    vector<double> z_square(m), rhs(m * C);
+    for(unsigned long i = 0; i < m; i++){
+        z[i] = support_vector(kept[i]);
+        pointers[i] = &z[i];
+        z_square[i] = square[kept[i]];
+    }
+    run_parallel((m + TILE - 1) / TILE, [&](unsigned long k){
+        vector<double> dense(dense_size * TILE, 0);
+        unsigned long first = k * TILE;
+        predict_tile(&pointers[first], &z_square[first], min<unsigned long>(TILE, m - first), dense, &rhs[first*C]);
+    });
+    for(unsigned long i = 0; i < m; i++)
+        for(unsigned long c = 0; c < C; c++)
+            rhs[i*C + c] += model.threshold[c];
+
+    // Cholesky factor of K_zz, adding jitter to the diagonal until it is positive definite
+    vector<double> K(m * m), L(m * m);
+    run_parallel(m, [&](unsigned long i){
+        vector<double> dense(dense_size, 0);
+        for(lasvm_sparsevector_t::iterator iter = z[i].begin(); iter != z[i].end(); iter++)
+            dense[iter->first] = iter->second;
+        for(unsigned long j = 0; j <= i; j++){
+            double dot = 0;
+            for(lasvm_sparsevector_t::iterator iter = z[j].begin(); iter != z[j].end(); iter++)
+                dot += dense[iter->first] * iter->second;
+            K[i*m + j] = K[j*m + i] = kernel_value(dot, z_square[i], z_square[j]);
+        }
+    });
+    double jitter = 1e-10 * max(1.0, K[0]);
+    bool positive = false;
+    while(!positive){
+        positive = true;
+        for(unsigned long j = 0; j < m && positive; j++){
+            double d = K[j*m + j] + jitter;
+            for(unsigned long k = 0; k < j; k++)
+                d -= L[j*m + k] * L[j*m + k];
+            if(d <= 0){
+                positive = false;
+                jitter *= 10;
+                break;
+            }
+            L[j*m + j] = sqrt(d);
+            for(unsigned long i = j + 1; i < m; i++){
+                double s = K[i*m + j];
+                for(unsigned long k = 0; k < j; k++)
+                    s -= L[i*m + k] * L[j*m + k];
+                L[i*m + j] = s / L[j*m + j];
+            }
+        }
+    }
+    vector<double> beta(rhs);
+    for(unsigned long c = 0; c < C; c++){ // L L' beta = rhs
+        for(unsigned long i = 0; i < m; i++){
+            double s = beta[i*C + c];
+            for(unsigned long k = 0; k < i; k++)
+                s -= L[i*m + k] * beta[k*C + c];
+            beta[i*C + c] = s / L[i*m + i];
+        }
+        for(unsigned long i = m; i-- > 0; ){
+            double s = beta[i*C + c];
+            for(unsigned long k = i + 1; k < m; k++)
+                s -= L[k*m + i] * beta[k*C + c];
+            beta[i*C + c] = s / L[i*m + i];
+        }
+    }
+
+    // the reduced model shares everything but its SVs and weights with the full model
+    vector<uint64_t> start(1, 0), feature;
+    vector<double> value;
+    for(unsigned long i = 0; i < m; i++){
+        for(uint64_t p = model.sv_start[kept[i]]; p < model.sv_start[kept[i]+1]; p++){
+            feature.push_back(model.sv_feature[p]);
+            value.push_back(model.sv_value[p]);
+        }
+        start.push_back(feature.size());
+    }
+    vector<int32_t> classes(labels.begin(), labels.end());
+    lasvm_model_t full = model, reduced = model;
+    reduced.kernel_type = kernel_type;
+    reduced.multiclass_type = multiclass_type;
+    reduced.degree = degree;
+    reduced.gamma = kgamma;
+    reduced.coef0 = coef0;
+    reduced.number_of_classes = labels.size();
+    reduced.labels = classes.data();
+    reduced.number_of_sv = m;
+    reduced.number_of_weights = 0;
+    reduced.sv_start = start.data();
+    reduced.sv_feature = feature.data();
+    reduced.sv_value = value.data();
+    reduced.sv_square = z_square.data();
+    reduced.alpha = beta.data();
+
+    // held-out decision values of both models
+    vector<double> f_full, f_reduced;
+    accumulator statistics_full, statistics_reduced;
+    predict(number_of_instances, f_full, statistics_full);
+    model = reduced;
+    if(inverted_index) // the postings name the SVs of the model they index
+        build_inverted_index();
+    predict(number_of_instances, f_reduced, statistics_reduced);
+    double error = 0, largest = 0, scale = 0;
+    unsigned long agree = 0;
+    for(unsigned long i = 0; i < number_of_instances; i++){
+        for(unsigned long c = 0; c < C; c++){
+            double e = fabs(f_full[i*C + c] - f_reduced[i*C + c]);
+            error += e;
+            largest = max(largest, e);
+            scale += fabs(f_full[i*C + c]);
+        }
+        if(decision(&f_full[i*C]) == decision(&f_reduced[i*C]))
+            agree++;
+    }
+    double n = static_cast<double>(number_of_instances);
+    cout << "Support vectors = " << l << " -> " << m << endl;
+    cout << "Decision value error on the held-out set: mean = " << error / (n * static_cast<double>(C))
+         << ", max = " << largest << ", relative = " << (scale > 0 ? error / scale : 0) << endl;
+    cout << "Label agreement = " << agree << "/" << number_of_instances << "=" << static_cast<double>(agree) / n * 100 << endl;
+    cout << "Full model:" << endl;
+    print_statistics(statistics_full);
+    cout << "Reduced model:" << endl;
+    print_statistics(statistics_reduced);
+    save_model(output_name);
+    model = full;
+    if(inverted_index)
+        build_inverted_index();
+}
+
+
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name, char *output_file_name)
 {
     int i; 
     
     // parse options
     for(i=1;i<argc;i++){
-		if(argv[i][0] != '-') 
+		if(argv[i][0] != '-' || argv[i][1] == '\0') // - alone is the standard input
 			break;
 		++i;
 		switch(argv[i-1][1]){
 			case 'B':
 				is_binary=stoi(argv[i]);
 				break;
+			case 'j':
+				threads=max(1UL, stoul(argv[i]));
+				break;
+			case 'L':
+				server_name=argv[i];
+				break;
+			case 'b':
+				batch_size=max(1UL, stoul(argv[i]));
+				break;
+			case 'w':
+				batch_window=stod(argv[i]);
+				break;
+			case 's':
+				chunk_size=stoul(argv[i]);
+				break;
+			case 'v':
+				write_values=stoi(argv[i]);
+				break;
+			case 'c':
+				reduced_size=stod(argv[i]);
+				break;
+			case 'O':
+				model_format=stoi(argv[i]);
+				break;
+			case 'r':
+				ranking=stoi(argv[i]);
+				break;
+			case 'e':
+				early_exit=stoi(argv[i]);
+				break;
+			case 'i':
+				inverted_index=stoi(argv[i]);
+				break;
+			case 't': {
+				vector<string> values;
+				boost::split(values, argv[i], boost::is_any_of(","), boost::token_compress_on);
+				sweep.clear();
+				for (unsigned long k = 0; k < values.size(); k++)
+					if (!values[k].empty())
+						sweep.push_back(stod(values[k]));
+				break;
+			}
 			default:
 				cerr << "Unknown option" << endl;
 				exit_with_help();
@@ -210,6 +1487,13 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
     if(i>=argc)
 		exit_with_help();
 
+    if(!server_name.empty()){ // the server only needs the model
+		if(argc != i+1)
+			exit_with_help();
+		strncpy(model_file_name, argv[i], 1024);
+		return;
+    }
+
 	strncpy(input_file_name, argv[i], 1024);
 
     if(i<argc-1)
@@ -235,21 +1519,65 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 
 
 int main(int argc, char **argv)  {
-	cout << endl << "la test" << endl << "_______" << endl;
-    
 	char input_file_name[1024] = {'\0'};
     char model_file_name[1024] = {'\0'};
     char output_file_name[1024] = {'\0'};
     parse_command_line(argc, argv, input_file_name, model_file_name, output_file_name);
+	if (server_name == "-") // the standard output carries the answers
+		cout.rdbuf(cerr.rdbuf());
+	cout << endl << "la test" << endl << "_______" << endl;
 
-	double threshold;
+	vector<double> threshold;
 	unsigned long number_of_sv(0), number_of_features(0), number_of_instances(0);
 	int is_sparse = 1;
      
-	libsvm_load_model( model_file_name, number_of_sv, number_of_features, threshold, degree, kgamma, coef0, Xsv, xsv_square, alpha);
+	if (lasvm_model_is_binary(model_file_name))
+		binary_load_model(model_file_name, number_of_sv, number_of_features, threshold);
+	else {
+		libsvm_load_model( model_file_name, number_of_sv, number_of_features, threshold, degree, kgamma, coef0, Xsv, xsv_square, alpha);
+		pack_support_vectors(number_of_sv, number_of_features, threshold);
+	}
+	if (early_exit) {
+		if (labels.size() != 2) {
+			cerr << "Early exit needs a two class model" << endl;
+			exit(EXIT_FAILURE);
+		}
+		if (ranking || reduced_size > 0) {
+			cerr << "Early exit does not compute the full decision values needed by -r and -c" << endl;
+			exit(EXIT_FAILURE);
+		}
+		order_support_vectors();
+	}
+	if (inverted_index) {
+		if (early_exit) {
+			cerr << "Early exit and the inverted index cannot be combined" << endl;
+			exit(EXIT_FAILURE);
+		}
+		build_inverted_index();
+	}
+	if (!server_name.empty()) {
+		serve(server_name);
+		return 0;
+	}
+	if (chunk_size > 0) {
+		if (is_binary != 0) {
+			cerr << "Streaming reads libsvm ascii files only" << endl;
+			exit(EXIT_FAILURE);
+		}
+		test_stream(input_file_name, output_file_name, threshold.size());
+		lasvm_model_unmap(&model);
+		return 0;
+	}
 	load_data_file(input_file_name, is_binary, number_of_features, number_of_instances, X, Y, x_square, kernel_type, kgamma, is_sparse, splits);
+	if (feature_map.type != LASVM_APPROX_NONE)
+		for (unsigned long i = 0; i < number_of_instances; i++)
+			X[i] = lasvm_approx_apply(feature_map, X[i]);
     
-	test(output_file_name, number_of_instances, number_of_sv, alpha, Y, threshold);
+	if (reduced_size > 0)
+		reduce(output_file_name, number_of_instances);
+	else
+		test(output_file_name, number_of_instances, threshold.size());
+	lasvm_model_unmap(&model);
 }
 
 
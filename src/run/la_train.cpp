@@ -1,22 +1,32 @@
 #include <cmath>
-#include <ctime>
 
 #include <vector>
 #include <map>
 #include <numeric>
 #include <algorithm>
+#include <atomic>
+#include <set>
+#include <thread>
+#include <chrono>
 
 #include <cstring>
 #include <cstdio>
 #include <cstdlib>
 #include <string>
+#include <stdexcept>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 
 #include "../lasvm/vector.hpp"
 #include "../lasvm/lasvm.hpp"
+#include "../lasvm/approx.hpp"
+#include "../lasvm/pool.hpp"
+#include "../lasvm/profile.hpp"
+#include "../lasvm/model.hpp"
 #include "../io/io.hpp"
+#include "../io/io_split.hpp"
+#include "../io/io_libsvm.hpp"
 
 #define LINEAR  0
 #define POLY    1
@@ -34,19 +44,22 @@
 #define SVS 1
 #define TIME 2
 
+#define ONE_VS_REST 0
+#define ONE_VS_ONE 1
+
 static const char *kernel_type_table[] = {"linear","polynomial","rbf","sigmoid"};
 
 using namespace std;
 
 class stopwatch{
 public:
-    stopwatch() : start(clock()){} //start counting time
+    stopwatch() : start(lasvm_profile_now()){} //start counting wall time, threads do not inflate it
     ~stopwatch();
     double get_time(){
-            return static_cast<double>(clock()-start)/CLOCKS_PER_SEC;
+            return lasvm_profile_now()-start;
         }
 private:
-    std::clock_t start;
+    double start;
 };
 stopwatch::~stopwatch(){
     cout << "Time (in secs): "<< stopwatch::get_time() << " selected" <<endl;
@@ -65,10 +78,15 @@ static int use_threshold = 1;                     // use threshold via constrain
 static int selection_type = RANDOM;        // RANDOM, GRADIENT or MARGIN selection strategies
 static int optimizer = ONLINE_WITH_FINISHING; // strategy of optimization
 static double C=1;                       // C, penalty on errors
+static vector <double> cost_path;        // values of C trained one after the other, warm-started
+static vector <double> gamma_grid;       // values of gamma searched by the grid search
+static vector <double> weight_grid;      // weights of the positive class searched by the grid search
+static double holdout=0;                 // fraction of the examples scoring the grid search, 0=off
 static double C_neg=1;                   // C-Weighting for negative examples
 static double C_pos=1;                   // C-Weighting for positive examples
 static int epochs=1;                     // epochs of online learning
 static unsigned long candidates=50;				  // number of candidates for "active" selection process
+static unsigned long pool_size=0;                 // candidates whose decision values are kept up to date, 0=off
 static double deltamax=1000;			  // tolerance for performing reprocess step, 1000=1 reprocess only
 static vector <unsigned long> select_size;      // Max number of SVs to take with selection strategy (for early stopping) 
 static vector <double> x_square;         // norms of input vectors, used for RBF
@@ -78,33 +96,95 @@ static int verbosity=1;                  // verbosity level, 0=off
 static int saves = 1;
 static unsigned long cache_size=256;                       // 256Mb cache size as default
 static double epsilon_gradient=1e-3;                       // tolerance on gradients
-static unsigned long long kernel_evaluation_counter=0;                      // number of kernel evaluations
+static atomic<unsigned long long> kernel_evaluation_counter(0);             // number of kernel evaluations
 static int is_binary=0;
 static map<unsigned long , int> splits;
 static int termination_type=0;
+static unsigned long threads=1;                            // threads computing kernel blocks or sub-problems
+static int multiclass_type=ONE_VS_REST;                    // ONE_VS_REST or ONE_VS_ONE decomposition
+static unsigned long shards=0;                             // partitions of cascade training, 0=off
+static int linear_model=0;                                 // save w and b instead of SVs for the linear kernel
+static unsigned long budget_size=0;                        // maximum number of support vectors, 0=no limit
+static int precision=LASVM_DOUBLE;                         // solver coefficients and gradients in double or float
+static string checkpoint_file_name;                        // solver and driver state, resumed from when it exists
+static unsigned long checkpoint_interval=10000;            // examples processed between checkpoints
+static atomic<unsigned long long> random_state(0);         // state of llrand(), saved in checkpoints
+static thread_local unsigned long long *job_random_state = NULL; // state of the job run by this thread, NULL for random_state
+static unsigned long folds=0;                              // k of k-fold cross-validation, 0=off
+static string fold_file_name;                              // split file giving the fold of each instance
+static unsigned long stream_window=0;                      // examples waiting for selection in streaming mode, 0=off
+static string profile_file_name;                           // report of the time spent in each phase, - for stdout
+static int approximation=LASVM_APPROX_NONE;                // explicit feature map replacing the rbf kernel
+static unsigned long approximation_dimension=1000;         // random features or landmarks of the feature map
+static lasvm_approx_t feature_map;                         // saved with the model, applied by la_test
+static vector<lasvm_vector_t> Z;                           // the mapped examples, dense, which then replace X
+static int model_format=0;                                 // model files as 0=text, 1=binary
+
+/* Binary sub-problem of a (possibly multiclass) problem */
+struct subproblem {
+	int positive;                    // label trained as +1
+	int negative;                    // label trained as -1, every other label for one-vs-rest
+	vector<unsigned long> examples;  // examples taking part in the sub-problem
+	vector<unsigned long> svind;     // support vector indices
+	vector<double> svalpha;          // support vector weights
+	double threshold;
+	vector<subproblem> path;         // solutions for each value of C of the regularization path
+	subproblem() : positive(1), negative(-1), threshold(0) {}
+	double label(unsigned long i) const { return Y.at(i) == positive ? 1.0 : -1.0; }
+};
 
 
 /* Functions' prototypes*/
 
 [[noreturn]]void exit_with_help();
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name);
-int libsvm_save_model(const char *model_file_name, unsigned long number_of_sv, unsigned long *svind, double threshold);
+void libsvm_save_model(char *model_file_name, const subproblem *problems, unsigned long number_of_problems, const vector<int>& labels);
+void binary_save_model(char *model_file_name, const subproblem *problems, unsigned long number_of_problems, const vector<int>& labels,
+                       const map<unsigned long, vector<double> >& weights);
 double kernel(unsigned long i, unsigned long j, void *kparam);
-void finish(lasvm_t *sv, unsigned long& number_of_sv, double& threshold, vector<double>& alpha, unsigned long* svind);
+const lasvm_sparsevector_t& example(unsigned long i);
+double linear_dot(unsigned long i, void *w);
+void linear_update(unsigned long i, double a, void *w);
+unsigned long finish(lasvm_t *sv, subproblem& problem);
 void make_old(unsigned long val, vector <unsigned long>& inew, vector<unsigned long>& iold);
-unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned long>& iold);
-void train_online(char *model_file_name, vector<double>& alpha, unsigned long& number_of_sv, unsigned long *svind, vector<unsigned long>& inew, 
-	vector<unsigned long>& iold, double& threshold, map<unsigned long, int> Y, unsigned long number_of_instances);
+unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned long>& iold, lasvm_pool_t *pool);
+bool is_number(const char *s);
+int parse_values(int argc, char **argv, int i, vector<double>& values);
+void train_online(char *model_file_name, subproblem& problem, unsigned long kernel_threads, unsigned long jobs);
+void train_online(char *model_file_name, subproblem& problem, lasvm_kcache_t *kcache, 
+                  double weight_pos, double weight_neg);
+void train_path(lasvm_t *sv, subproblem& problem, double weight_pos, double weight_neg);
+double holdout_accuracy(const subproblem& solution, const vector<unsigned long>& examples, double *gamma);
+void grid_search(char *model_file_name, subproblem& problem);
+void make_subproblems(vector<int>& labels, vector<subproblem>& problems);
+template<typename F> void run_parallel(unsigned long n, F job);
+void merge_subproblems(const subproblem& a, const subproblem& b, subproblem& merged, unsigned long jobs);
+void train_cascade(char *model_file_name, subproblem& problem);
+void train_subproblems(char *model_file_name, vector<subproblem>& problems);
+int predict_label(const vector<subproblem>& models, const vector<int>& labels, unsigned long i);
+void cross_validation(char *model_file_name, const vector<subproblem>& problems, const vector<int>& labels);
+void train_stream(char *input_file_name, char *model_file_name);
+void approximate_kernel();
+void write_profile();
+void save_checkpoint(lasvm_t *sv, const vector<double>& w, int epoch, unsigned long position, 
+                     const vector<unsigned long>& inew, const vector<unsigned long>& iold, const vector<unsigned long>& sizes);
+bool load_checkpoint(lasvm_t *sv, vector<double>& w, int& epoch, unsigned long& position, 
+                     vector<unsigned long>& inew, vector<unsigned long>& iold, vector<unsigned long>& sizes);
 unsigned long long llrand();
+unsigned long long mix64(unsigned long long r);
 
 unsigned long long llrand() {
-	unsigned long long r = 0;
-
-	for (int i = 0; i < 5; ++i) {
-		r = (r << 15) | (rand() & 0x7FFF);
-	}
+	// splitmix64, the whole state is one counter so that it can be checkpointed;
+	// jobs of run_parallel draw from their own counter so that results do not depend on the thread timing
+	unsigned long long r = job_random_state ? (*job_random_state += 0x9E3779B97F4A7C15ULL)
+	                                        : random_state.fetch_add(0x9E3779B97F4A7C15ULL) + 0x9E3779B97F4A7C15ULL;
+	return mix64(r);
+}
 
-	return r & 0xFFFFFFFFFFFFFFFFULL;
+unsigned long long mix64(unsigned long long r) {
+	r = (r ^ (r >> 30)) * 0xBF58476D1CE4E5B9ULL;
+	r = (r ^ (r >> 27)) * 0x94D049BB133111EBULL;
+	return r ^ (r >> 31);
 }
 
 [[noreturn]]void exit_with_help(){
@@ -134,30 +214,91 @@ unsigned long long llrand() {
 		"-l sample: number of iterations/SVs/seconds to sample for early stopping (default all)" << endl <<
 		" if a list of numbers is given a model file is saved for each element of the set" << endl <<
 		"-C candidates : set number of candidates to search for selection strategy (default 50)" << endl <<
+		"-q pool : keep the decision values of this many candidates up to date as the model changes," << endl <<
+		" selection then picks the best of them instead of scoring -C new candidates (default 0=off)" << endl <<
 		"-d degree : set degree in kernel function (default 3)" << endl <<
 		"-g gamma : set gamma in kernel function (default 1/k)" << endl <<
 		"-r coef0 : set coef0 in kernel function (default 0)" << endl <<
-		"-c cost : set the parameter C of C-SVC" << endl <<
+		"-c cost : set the parameter C of C-SVC, several values train a regularization path" << endl <<
+		" where each C starts from the solution of the previous one (model_file_C<cost> for each)" << endl <<
+		"-G fraction : grid search, holds out this fraction of the examples to score every combination" << endl <<
+		" of the values given to -g, -c and -w1 on -j threads, one kernel cache per gamma, keeps the best model" << endl <<
 		"-m cachesize : set cache memory size in MB (default 256)" << endl <<
-		"-wi weight: set the parameter C of class i to weight*C (default 1)" << endl <<
+		"-wi weight: set the parameter C of class i to weight*C (default 1), several values for -w1 are searched by -G" << endl <<
 		"-b bias: use a bias or not i.e. no constraint sum alpha_i y_i =0 (default 1=on)" << endl <<
 		"-e epsilon : set tolerance of termination criterion (default 0.001)" << endl <<
 		"-p epochs : number of epochs to train in online setting (default 1)" << endl <<
-		"-D deltamax : set tolerance for reprocess step, 1000=1 call to reprocess >1000=no calls to reprocess (default 1000)" << endl;
+		"-D deltamax : set tolerance for reprocess step, 1000=1 call to reprocess >1000=no calls to reprocess (default 1000)" << endl <<
+		"-j threads : number of threads computing kernel values for candidate selection," << endl <<
+		" or training the binary sub-problems of a multiclass problem (default 1)" << endl <<
+		"-M multiclass : set the decomposition of problems with more than two classes (default 0)" << endl <<
+		"	0 -- one-vs-rest, predicts the class with the largest output " << endl <<
+		"	1 -- one-vs-one, predicts the class with the most votes " << endl <<
+		"-P shards : cascade training, trains this many random partitions on -j threads" << endl <<
+		" and merges their support vectors pairwise until one model is left (default 0=off)" << endl <<
+		"-W linear: save the linear kernel model as weight vectors w and thresholds b instead of SVs (default 0=off);" << endl <<
+		" training the linear kernel keeps w in all cases, which scores new examples in O(nnz) but leaves" << endl <<
+		" each optimization step in O(#SV) kernel values" << endl <<
+		"-S maxsv : keep at most maxsv support vectors, removing the one with the worst margin (default 0=no limit)" << endl <<
+		"-f precision : store the solver coefficients and gradients as 0=double, 1=float (default 0)" << endl <<
+		"-K file : checkpoint the training state to file, and resume from it if it exists (two classes only)" << endl <<
+		"-k iterations : number of examples processed between checkpoints (default 10000)" << endl <<
+		"-v folds : cross-validation, trains the folds of a random partition on -j threads and reports their accuracy," << endl <<
+		" no model is saved" << endl <<
+		"-V file : cross-validation over the folds given by a split file, the label of each instance is its fold 1..k" << endl <<
+		"-I window : streaming, reads libsvm examples one at a time (training_set_file - reads the standard input)" << endl <<
+		" and processes the one chosen by -s among the last <window> read, labels > 0 are the positive class;" << endl <<
+		" only those and the support vectors are kept, bound them with -S for constant memory" << endl <<
+		"-a approximation : map the examples so that the rbf kernel becomes linear and train a linear model (default 0)" << endl <<
+		"	0 -- off" << endl <<
+		"	1 -- random Fourier features" << endl <<
+		"	2 -- Nystrom, random examples as landmarks" << endl <<
+		"-n dimension : number of random features or landmarks of -a (default 1000)" << endl <<
+		"-R file : record the wall time and calls of each phase (load, select, process, reprocess, finish," << endl <<
+		" kernel, cache_fill, swap, save) and write them to file as tab separated values (- for standard output)" << endl <<
+		"-O format : model file format, read by la_test in both cases (default 0)" << endl <<
+		"	0 -- text" << endl <<
+		"	1 -- binary, memory mapped by la_test without parsing" << endl;
     exit( EXIT_FAILURE );
 }
 
 
+bool is_number(const char *s){
+    // true when the whole of s is a number
+	size_t idx = 0;
+	try {
+		stod(s, &idx);
+	}
+	catch (const logic_error&) {
+		return false;
+	}
+	return idx == strlen(s);
+}
+
+
+int parse_values(int argc, char **argv, int i, vector<double>& values){
+    // reads the numbers starting at argv[i], returns the index of the last one,
+    // leaving the training set and model file names that end the command line
+	values.clear();
+	while (1){
+		values.push_back(stod(argv[i]));
+		++i;
+		if ( i>=argc-2 || !is_number(argv[i]) )
+			break;
+	}
+	return i-1;
+}
+
+
 void parse_command_line(int argc, char **argv, char *input_file_name, char *model_file_name)
 {
     int i= 0;
 	int clss = 0; 
-	double weight = 0;
     
     // parse options
     for(i=1;i<argc;i++){
 
-        if(argv[i][0] != '-') 
+        if(argv[i][0] != '-' || argv[i][1] == '\0') // a lone - is the standard input
 			break;
         ++i;
         switch(argv[i-1][1]){
@@ -184,7 +325,8 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				degree = stod(argv[i]);
 				break;
 			case 'g':
-				kgamma = stod(argv[i]);
+				i = parse_values(argc, argv, i, gamma_grid);
+				kgamma = gamma_grid[0];
 				break;
 			case 'r':
 				coef0 = stod(argv[i]);
@@ -193,15 +335,29 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 				cache_size = stoul(argv[i]);
 				break;
 			case 'c':
-				C = stod(argv[i]);
+				i = parse_values(argc, argv, i, cost_path);
+				C = cost_path[0];
 				break;
 			case 'w':
 				clss = stoi(&argv[i - 1][2]);
-				weight = stod(argv[i]);
-				if (clss >= 1) 
-					C_pos = weight; 
+				if (clss >= 1){
+					i = parse_values(argc, argv, i, weight_grid);
+					C_pos = weight_grid[0];
+				}
 				else 
-					C_neg = weight;
+					C_neg = stod(argv[i]);
+				break;
+			case 'G':
+				holdout = stod(argv[i]);
+				break;
+			case 'v':
+				folds = stoul(argv[i]);
+				break;
+			case 'V':
+				fold_file_name = argv[i];
+				break;
+			case 'I':
+				stream_window = stoul(argv[i]);
 				break;
 			case 'b':
 				use_threshold = stoi(argv[i]);
@@ -224,6 +380,46 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 			case 'T':
 				termination_type = stoi(argv[i]);
 				break;
+			case 'j':
+				threads = max(1UL, stoul(argv[i]));
+				break;
+			case 'M':
+				multiclass_type = stoi(argv[i]);
+				break;
+			case 'P':
+				shards = stoul(argv[i]);
+				break;
+			case 'W':
+				linear_model = stoi(argv[i]);
+				break;
+			case 'O':
+				model_format = stoi(argv[i]);
+				break;
+			case 'S':
+				budget_size = stoul(argv[i]);
+				break;
+			case 'R':
+				profile_file_name = argv[i];
+				lasvm_profile_enable(1);
+				break;
+			case 'q':
+				pool_size = stoul(argv[i]);
+				break;
+			case 'a':
+				approximation = stoi(argv[i]);
+				break;
+			case 'n':
+				approximation_dimension = stoul(argv[i]);
+				break;
+			case 'f':
+				precision = stoi(argv[i]) ? LASVM_FLOAT : LASVM_DOUBLE;
+				break;
+			case 'K':
+				checkpoint_file_name = argv[i];
+				break;
+			case 'k':
+				checkpoint_interval = stoul(argv[i]);
+				break;
 			default:
 				cerr << "Unknown option" << endl;
 				exit_with_help();
@@ -255,14 +451,33 @@ void parse_command_line(int argc, char **argv, char *input_file_name, char *mode
 }
 
 
-void libsvm_save_model(char *model_file_name, unsigned long number_of_sv, unsigned long *svind, double threshold){
-    // saves the model in the same format as LIBSVM
+void libsvm_save_model(char *model_file_name, const subproblem *problems, unsigned long number_of_problems, const vector<int>& labels){
+    // saves the model in a format close to LIBSVM: one weight per binary classifier on each SV line
+	lasvm_profile_scope profile(LASVM_PHASE_SAVE);
+	map<unsigned long, vector<double> > weights;
+	for (unsigned long k=0; k < number_of_problems; k++)
+		for (unsigned long iter=0; iter < problems[k].svind.size(); iter++){
+			vector<double>& w = weights[problems[k].svind[iter]];
+			w.resize(number_of_problems, 0);
+			w[k] = problems[k].svalpha[iter];
+		}
+	if (model_format == 1){
+		binary_save_model(model_file_name, problems, number_of_problems, labels, weights);
+		return;
+	}
+
 	ofstream model;
 	model.open(model_file_name);
 
 	if (model.is_open()) {
 		model << "Svm_type: C_svc" << endl;
-		model << "Kernel_type: " << kernel_type_table[kernel_type] << endl;
+		if (feature_map.type != LASVM_APPROX_NONE){ // linear in the mapped space, rbf for the user
+			model << "Kernel_type: " << kernel_type_table[RBF] << endl;
+			model << "gamma = " << feature_map.gamma << endl;
+			model << "Approximation: " << lasvm_approx_table[feature_map.type] << " " << feature_map.dimension << endl;
+		}
+		else
+			model << "Kernel_type: " << kernel_type_table[kernel_type] << endl;
 		if (kernel_type == POLY)
 			model << "degree = " << degree << endl;
 
@@ -270,16 +485,51 @@ void libsvm_save_model(char *model_file_name, unsigned long number_of_sv, unsign
 			model << "gamma = " << kgamma << endl;
 
 		if (kernel_type == POLY || kernel_type == SIGMOID)
-			model << "coef0 = " << coef0;
-
-		model << "Number of classes: " << 2 << endl;
-		model << "Number of support vectors: " << number_of_sv << endl;
-		model << "rho = " << threshold << endl;
-		model << "Labels: " << 1 << " " << -1 << endl;
-		model << "SV:" << endl;
-		for (unsigned long iter=0; iter < number_of_sv; iter++)
-			model << Y[svind[iter]] << lasvm_sparsevector_print(X[svind[iter]]);
+			model << "coef0 = " << coef0 << endl;
+
+		model << "Number of classes: " << labels.size() << endl;
+		if (labels.size() > 2)
+			model << "Multiclass: " << (multiclass_type == ONE_VS_ONE ? "one_vs_one" : "one_vs_rest") << endl;
+		if (kernel_type != LINEAR || !linear_model)
+			model << "Number of support vectors: " << weights.size() << endl;
+		model << "rho =";
+		for (unsigned long k=0; k < number_of_problems; k++)
+			model << " " << problems[k].threshold;
+		model << endl;
+		model << "Labels:";
+		for (unsigned long c=0; c < labels.size(); c++)
+			model << " " << labels[c];
+		model << endl;
+		model.precision(17);
+		if (kernel_type == LINEAR && linear_model){ // one line w = sum_i alpha_i x_i per binary classifier
+			model << "W:" << endl;
+			for (unsigned long k=0; k < number_of_problems; k++){
+				lasvm_sparsevector_t w;
+				for (unsigned long iter=0; iter < problems[k].svind.size(); iter++){
+					const lasvm_sparsevector_t& x = example(problems[k].svind[iter]);
+					for (lasvm_sparsevector_t::const_iterator feature = x.begin(); feature != x.end(); feature++)
+						w[feature->first] += problems[k].svalpha[iter] * feature->second;
+				}
+				model << lasvm_sparsevector_print(w);
+			}
+			if (feature_map.type != LASVM_APPROX_NONE){
+				model << "Map:" << endl;
+				model << lasvm_approx_print(feature_map);
+			}
+		}
+		else {
+			model << "SV:" << endl;
+			for (map<unsigned long, vector<double> >::iterator iter = weights.begin(); iter != weights.end(); iter++){
+				for (unsigned long k=0; k < number_of_problems; k++)
+					model << (k ? " " : "") << iter->second[k];
+				model << lasvm_sparsevector_print(example(iter->first));
+			}
+		}
 		model.close();
+		if (model.fail()){
+			cerr << "Could not write file:" << model_file_name << endl;
+			exit(EXIT_FAILURE);
+		}
 	}
 	else {
 		cerr << "Could not open file:" << model_file_name << endl;
@@ -287,8 +537,87 @@ void libsvm_save_model(char *model_file_name, unsigned long number_of_sv, unsign
 	}
 }
 
+void binary_save_model(char *model_file_name, const subproblem *problems, unsigned long number_of_problems, const vector<int>& labels,
+                       const map<unsigned long, vector<double> >& weights){
+    // same content as the text model, as the arrays of lasvm_model_t
+	vector<double> threshold, sv_value, sv_square, alpha, w;
+	vector<int32_t> classes(labels.begin(), labels.end());
+	vector<uint64_t> sv_start(1, 0), sv_feature;
+	string map_text;
+	lasvm_model_t model;
+	memset(&model, 0, sizeof(model));
+	for (unsigned long k=0; k < number_of_problems; k++)
+		threshold.push_back(problems[k].threshold);
+
+	if (kernel_type == LINEAR && linear_model){ // dense w = sum_i alpha_i x_i per binary classifier
+		for (unsigned long k=0; k < number_of_problems; k++)
+			for (unsigned long iter=0; iter < problems[k].svind.size(); iter++){
+				const lasvm_sparsevector_t& x = example(problems[k].svind[iter]);
+				if (!x.empty())
+					model.number_of_features = max(model.number_of_features, x.rbegin()->first);
+			}
+		w.assign(number_of_problems * (model.number_of_features + 1), 0);
+		for (unsigned long k=0; k < number_of_problems; k++)
+			for (unsigned long iter=0; iter < problems[k].svind.size(); iter++){
+				const lasvm_sparsevector_t& x = example(problems[k].svind[iter]);
+				for (lasvm_sparsevector_t::const_iterator feature = x.begin(); feature != x.end(); feature++)
+					w[k * (model.number_of_features + 1) + feature->first] += problems[k].svalpha[iter] * feature->second;
+			}
+		model.number_of_weights = number_of_problems;
+	}
+	else
+		for (map<unsigned long, vector<double> >::const_iterator iter = weights.begin(); iter != weights.end(); iter++){
+			const lasvm_sparsevector_t& x = example(iter->first);
+			for (lasvm_sparsevector_t::const_iterator feature = x.begin(); feature != x.end(); feature++){
+				sv_feature.push_back(feature->first);
+				sv_value.push_back(feature->second);
+			}
+			if (!x.empty())
+				model.number_of_features = max(model.number_of_features, x.rbegin()->first);
+			sv_start.push_back(sv_feature.size());
+			sv_square.push_back(lasvm_sparsevector_square(x));
+			alpha.insert(alpha.end(), iter->second.begin(), iter->second.end());
+		}
+
+	model.kernel_type = kernel_type;
+	model.multiclass_type = multiclass_type;
+	model.degree = degree;
+	model.gamma = kgamma;
+	model.coef0 = coef0;
+	if (feature_map.type != LASVM_APPROX_NONE){ // linear in the mapped space, rbf for the user
+		map_text = lasvm_approx_print(feature_map);
+		model.kernel_type = RBF;
+		model.gamma = feature_map.gamma;
+		model.approximation = feature_map.type;
+		model.approximation_dimension = feature_map.dimension;
+		model.map = map_text.c_str();
+		model.map_size = map_text.size();
+	}
+	model.number_of_classifiers = number_of_problems;
+	model.number_of_classes = labels.size();
+	model.number_of_sv = sv_square.size();
+	model.threshold = threshold.data();
+	model.labels = classes.data();
+	model.sv_start = sv_start.data();
+	model.sv_feature = sv_feature.data();
+	model.sv_value = sv_value.data();
+	model.sv_square = sv_square.data();
+	model.alpha = alpha.data();
+	model.w = w.data();
+	if (lasvm_model_write(model_file_name, &model) != 0){
+		cerr << "Could not open file:" << model_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+}
+
 double kernel(unsigned long i, unsigned long j, void *kparam){
-    double dot_product = lasvm_sparsevector_dot_product(X[i], X[j]);
+    // kparam optionally points to the value of gamma, kgamma otherwise
+    double gamma = kparam ? *static_cast<double*>(kparam) : kgamma;
+    double dot_product;
+    if (!Z.empty())
+        dot_product = inner_product(Z[i].begin(), Z[i].end(), Z[j].begin(), 0.0);
+    else
+        dot_product = lasvm_sparsevector_dot_product(X.at(i), X.at(j)); // at() keeps concurrent calls read-only
     kernel_evaluation_counter++;
     
     // sparse, linear kernel
@@ -296,20 +625,55 @@ double kernel(unsigned long i, unsigned long j, void *kparam){
 		case LINEAR:
 			return dot_product;
 		case POLY:
-			return pow(kgamma*dot_product+coef0,degree);
+			return pow(gamma*dot_product+coef0,degree);
 		case RBF:
-			return exp(-kgamma*(x_square[i]+x_square[j]-2*dot_product));    
+			return exp(-gamma*(x_square[i]+x_square[j]-2*dot_product));    
 		case SIGMOID:
-			return tanh(kgamma*dot_product+coef0);    
+			return tanh(gamma*dot_product+coef0);    
     }
     return 0;
 } 
   
 
 
-void finish(lasvm_t *sv, unsigned long& number_of_sv, double& threshold, vector<double>& alpha, unsigned long* svind){
-	unsigned long i;
+const lasvm_sparsevector_t& example(unsigned long i){
+    // example i, rebuilt from Z when the examples are mapped; valid until the next call of the thread
+	static thread_local lasvm_sparsevector_t mapped;
+	if (Z.empty())
+		return X.at(i);
+	mapped.clear();
+	for (unsigned long q = 0; q < Z[i].size(); q++)
+		mapped.insert(mapped.end(), make_pair(q + 1, Z[i][q]));
+	return mapped;
+}
+
+
+double linear_dot(unsigned long i, void *w){
+    // dot product of example i with the explicit weight vector of the linear kernel
+	const vector<double>& weights = *static_cast<vector<double>*>(w);
+	if (!Z.empty())
+		return inner_product(Z[i].begin(), Z[i].end(), weights.begin() + 1, 0.0);
+	const lasvm_sparsevector_t& x = X.at(i);
+	double dot_product = 0;
+	for (lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+		dot_product += weights[iter->first] * iter->second;
+	return dot_product;
+}
+
+void linear_update(unsigned long i, double a, void *w){
+	vector<double>& weights = *static_cast<vector<double>*>(w);
+	if (!Z.empty()){
+		for (unsigned long q = 0; q < Z[i].size(); q++)
+			weights[q + 1] += a * Z[i][q];
+		return;
+	}
+	const lasvm_sparsevector_t& x = X.at(i);
+	for (lasvm_sparsevector_t::const_iterator iter = x.begin(); iter != x.end(); iter++)
+		weights[iter->first] += a * iter->second;
+}
 
+
+unsigned long finish(lasvm_t *sv, subproblem& problem){
     if (optimizer == ONLINE_WITH_FINISHING){
 		cout << "..[finishing]";
 
@@ -320,17 +684,13 @@ void finish(lasvm_t *sv, unsigned long& number_of_sv, double& threshold, vector<
 
     }
 
-    number_of_sv= lasvm_get_l(sv);
-    unsigned long svs;
-	svind = new  unsigned long[number_of_sv];
-    svs = lasvm_get_sv(sv,svind); 
-	fill(alpha.begin(), alpha.end(), 0);
-
-    double *svalpha = new double[number_of_sv];
-    lasvm_get_alpha(sv,svalpha); 
-    for(i=0;i<svs;i++) 
-		alpha[svind[i]]=svalpha[i];
-    threshold=lasvm_get_b(sv);
+    unsigned long number_of_sv = lasvm_get_l(sv);
+	problem.svind.resize(number_of_sv);
+	problem.svalpha.resize(number_of_sv);
+    lasvm_get_sv(sv, problem.svind.data()); 
+    lasvm_get_alpha(sv, problem.svalpha.data()); 
+    problem.threshold = lasvm_get_b(sv);
+    return number_of_sv;
 }
 
 
@@ -347,11 +707,24 @@ void make_old(unsigned long val, vector <unsigned long>& inew, vector<unsigned l
 }
 
 
-unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned long>& iold){ // selection strategy
+unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned long>& iold, lasvm_pool_t *pool){ // selection strategy
     unsigned long selected=0;
-    unsigned long t,i,r,j;
+    unsigned long t,i,j;
     double tmp,best;
-	unsigned long ind=0;
+	vector<unsigned long> ind, xi;   // candidate positions in inew and their example indices
+	vector<double> f;                // decision values of the candidates
+
+	if (pool){ // move random new points to the pool, take its best candidate
+		while (lasvm_pool_get_size(pool) < pool_size && inew.size() > 0){
+			selected = static_cast<unsigned long>(llrand() % inew.size());
+			lasvm_pool_add(pool, inew[selected]);
+			inew[selected] = inew[inew.size()-1];
+			inew.pop_back();
+		}
+		t = lasvm_pool_remove(pool, lasvm_pool_select(pool, selection_type==MARGIN));
+		iold.push_back(t);
+		return t;
+	}
 
     switch(selection_type){
 		case RANDOM:   // pick a random candidate
@@ -359,43 +732,26 @@ unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned l
 			break;
 
 		case GRADIENT: // pick best gradient from 50 candidates
+		case MARGIN:   // pick closest to margin from 50 candidates
 			j=candidates; 
 			if(inew.size()<j) 
 				j=static_cast<unsigned long>( inew.size() );
-			r= static_cast<unsigned long> (llrand() % inew.size() );
-			selected=r;
-			best=1e20;
 			for(i=0;i<j;i++){
-				r=inew[selected];
-				tmp=lasvm_predict(sv, r);  
-				if(tmp<best) {
-					best=tmp;
-					ind=selected;
-				}
-				selected=static_cast<unsigned long>(llrand() % inew.size());
-			}  
-			selected=ind;
-			break;
-
-		case MARGIN:  // pick closest to margin from 50 candidates
-			j=candidates;
-			if(inew.size()<j) 
-				j=static_cast<unsigned long>(inew.size());
-			r=static_cast<unsigned long>(llrand() % inew.size());
-			selected=r;
+				ind.push_back(static_cast<unsigned long>(llrand() % inew.size()));
+				xi.push_back(inew[ind.back()]);
+			}
+			f.resize(j);
+			lasvm_predict_batch(sv, j, xi.data(), f.data()); // scores all candidates at once, reusing their cached rows
 			best=1e20;
 			for(i=0;i<j;i++){
-				r=inew[selected];
-				tmp=lasvm_predict(sv, r);  
-				if (tmp<0) 
+				tmp=f[i];
+				if (selection_type==MARGIN && tmp<0) 
 					tmp=-tmp; 
 				if(tmp<best) {
 					best=tmp;
-					ind=selected;
+					selected=ind[i];
 				}
-				selected=static_cast<unsigned long>(llrand() % inew.size());
 			}  
-			selected=ind;
 			break;
     }
 	
@@ -408,58 +764,87 @@ unsigned long select(lasvm_t *sv, vector<unsigned long>& inew, vector<unsigned l
 }
 
 
-void train_online(char *model_file_name, vector<double>& alpha, unsigned long& number_of_sv, unsigned long *svind, vector<unsigned long>& inew,
-				  vector<unsigned long>& iold, double& threshold, map<unsigned long, int> Y, unsigned long number_of_instances){
+void train_online(char *model_file_name, subproblem& problem, unsigned long kernel_threads, unsigned long jobs){
+    // trains on its own kernel cache, the memory budget is split among the <jobs> trainings running at once
+    lasvm_kcache_t *kcache=lasvm_kcache_create(kernel, NULL);
+    lasvm_kcache_set_maximum_size(kcache, cache_size*1024*1024/jobs);
+    lasvm_kcache_set_threads(kcache, kernel_threads);
+	cout << "set cache size " << cache_size << endl;
+	train_online(model_file_name, problem, kcache, C_pos, C_neg);
+    lasvm_kcache_destroy(kcache);
+}
+
+
+void train_online(char *model_file_name, subproblem& problem, lasvm_kcache_t *kcache, 
+                  double weight_pos, double weight_neg){
+    // trains on a kernel cache which may be shared by successive calls
 	unsigned long n_process(0), n_reprocess(0);
 	unsigned long selected(0);
+	unsigned long number_of_sv(0);
+	unsigned long number_of_examples = static_cast<unsigned long>(problem.examples.size());
+	vector<unsigned long> iold, inew;         // sets of old (already seen) points + new (unseen) points
+	vector<unsigned long> sizes(select_size); // intermediate models still to save
+	vector<int> labels;
+	labels.push_back(problem.positive);
+	labels.push_back(problem.negative);
     double timer=0;
     stopwatch *sw; // start measuring time after loading is finished
     sw=new stopwatch;    // save timing information
-	char t[1500] = {'\0'};
-    strncpy(t ,model_file_name, 1500 );
-    strncat(t ,".time", 1500 - strlen(t) - 1);
     
-    lasvm_kcache_t *kcache=lasvm_kcache_create(kernel, NULL);
-    lasvm_kcache_set_maximum_size(kcache, cache_size*1024*1024);
-    lasvm_t *sv=lasvm_create(kcache,use_threshold,C*C_pos,C*C_neg);
-	cout << "set cache size " << cache_size << endl;
-
-    // everything is new when we start
-    inew.resize( number_of_instances );
-	iota(inew.begin(), inew.end(), 0);
-	cout << "initiation inew" << endl;
+    lasvm_t *sv=lasvm_create_precision(kcache,use_threshold,C*weight_pos,C*weight_neg,precision);
+	vector<double> w(number_of_features + 1, 0);  // explicit weight vector for the linear kernel
+	if (kernel_type == LINEAR)
+		lasvm_set_linear(sv, linear_dot, linear_update, &w);
+	lasvm_set_budget(sv, budget_size);
+	lasvm_pool_t *pool = NULL;  // candidates of active selection, out of inew
+	if (pool_size > 0 && (selection_type == GRADIENT || selection_type == MARGIN))
+		pool = lasvm_pool_create(sv, kcache);
+
+    // continue where a previous run was interrupted
+    int first_epoch=0;
+    unsigned long first_position=0;
+    bool resumed = load_checkpoint(sv, w, first_epoch, first_position, inew, iold, sizes);
+    if (resumed){
+		if (inew.size() + iold.size() != number_of_examples){
+			cerr << "Checkpoint " << checkpoint_file_name << " does not match the training set" << endl;
+			exit(EXIT_FAILURE);
+		}
+		cout << "resuming epoch " << first_epoch << " at example " << first_position << endl;
+	}
+	else
+		inew = problem.examples; // everything is new when we start
     
     // first add 5 examples of each class, just to balance the initial set
     int c1=0;
     int c2=0;
     unsigned long i = 0;
-    cout << c1 << "," << c2 << "," << number_of_instances << endl;
-    for(long p=0; p<number_of_instances; p++)
-        cout << ":";
-
-    for(i=0; i<number_of_instances; i++){
-    	cout << i << ":" ;
-        if(Y[i]==1 && c1<5) {
-			lasvm_process(sv,i,static_cast<double>(Y[i]) ); 
+	unsigned long processed = 0;
+    for(i=0; i<number_of_examples && !resumed; i++){
+		unsigned long e = problem.examples[i];
+		double y = problem.label(e);
+        if(y>0 && c1<5) {
+			lasvm_process(sv,e,y); 
 			c1++; 
-			make_old(i, inew, iold);
+			make_old(e, inew, iold);
 		}
-        if(Y[i]==-1 && c2<5){
-			lasvm_process(sv,i, static_cast<double>(Y[i]) );
+        if(y<0 && c2<5){
+			lasvm_process(sv,e,y);
 			c2++; 
-			make_old(i, inew, iold);
+			make_old(e, inew, iold);
 		}
         if(c1==5 && c2==5) 
 			break;
     }
     cout << "initialization svm" << endl;
-    for(int j=0;j<epochs;j++){
-        for(i=0; i<number_of_instances; i++) {
-            if(inew.size()==0) 
+    for(int j=first_epoch;j<epochs;j++){
+        for(i=(j==first_epoch)?first_position:0; i<number_of_examples; i++) {
+            if(inew.size()==0 && (!pool || lasvm_pool_get_size(pool)==0)) 
 				break; // nothing more to select
-            selected = select(sv,inew,iold);            // selection strategy, select new point
+            unsigned long long select_start = lasvm_profile_begin();
+            selected = select(sv,inew,iold,pool);       // selection strategy, select new point
+            lasvm_profile_end(LASVM_PHASE_SELECT, select_start);
             
-            n_process=lasvm_process(sv,selected, static_cast<double> (Y[selected]) );
+            n_process=lasvm_process(sv,selected, problem.label(selected));
             
             if (deltamax<=1000){ // potentially multiple calls to reprocess..
 
@@ -479,10 +864,10 @@ void train_online(char *model_file_name, vector<double>& alpha, unsigned long& n
             
             number_of_sv= lasvm_get_l(sv);
 
-            for(unsigned long k=0; k< static_cast<unsigned long> (select_size.size() ); k++){ 
-                if   ( (termination_type==ITERATIONS && i==select_size[k]) 
-                       || (termination_type==SVS && number_of_sv>=select_size[k])
-                       || (termination_type==TIME && sw->get_time()>=select_size[k])
+            for(unsigned long k=0; k< static_cast<unsigned long> (sizes.size() ); k++){ 
+                if   ( (termination_type==ITERATIONS && i==sizes[k]) 
+                       || (termination_type==SVS && number_of_sv>=sizes[k])
+                       || (termination_type==TIME && sw->get_time()>=sizes[k])
                     ) {
 
                     if(saves>1){ // if there is more than one model to save, give a new name
@@ -497,7 +882,7 @@ void train_online(char *model_file_name, vector<double>& alpha, unsigned long& n
                         save_sv = new unsigned long[number_of_sv];
 						lasvm_get_sv(sv,save_sv);
 				
-                        finish(sv, number_of_sv, threshold, alpha, svind); 
+                        number_of_sv = finish(sv, problem); 
 						stringstream tmp;
 						tmp.clear();
 
@@ -510,64 +895,740 @@ void train_online(char *model_file_name, vector<double>& alpha, unsigned long& n
                             cout << "..[saving model_"<< i << " pts]..";
 							tmp << model_file_name << "_" << i << "pts";
                         }
-                        libsvm_save_model( const_cast<char*>(tmp.str().c_str()) , number_of_sv, svind, threshold);  
+                        libsvm_save_model( const_cast<char*>(tmp.str().c_str()) , &problem, 1, labels);  
                         
                         lasvm_init(sv, save_l, save_sv, save_alpha, save_g); 
-                        delete save_alpha; 
-						delete save_sv;
-						delete save_g;
+                        delete[] save_alpha; 
+						delete[] save_sv;
+						delete[] save_g;
                         delete sw;
 						sw=new stopwatch;    // reset clock
                     }  
-                    select_size[k]=select_size[select_size.size()-1];
-                    select_size.pop_back();
+                    sizes[k]=sizes[sizes.size()-1];
+                    sizes.pop_back();
                 }
             }
-            if(select_size.size()==0) 
+            if(!checkpoint_file_name.empty() && checkpoint_interval>0 && (++processed % checkpoint_interval)==0){
+				vector<unsigned long> pending(inew); // pool candidates are new points too
+				for (unsigned long k=0; pool && k < lasvm_pool_get_size(pool); k++)
+					pending.push_back(lasvm_pool_get_example(pool, k));
+				save_checkpoint(sv, w, j, i+1, pending, iold, sizes);
+			}
+            if(sizes.size()==0) 
 				break; // early stopping, all intermediate models saved
         }
 
         inew.clear();
 		iold.clear(); // start again for next epoch..
-		inew.resize( number_of_instances );
-		iota(inew.begin(), inew.end() , 0);
+		inew = problem.examples;
+		while (pool && lasvm_pool_get_size(pool) > 0)
+			lasvm_pool_remove(pool, 0);
     }
+    if (pool)
+		lasvm_pool_destroy(pool); // the finishing step needs no selection
 
     if(saves<2){
-        finish(sv, number_of_sv, threshold, alpha, svind); // if haven't done any intermediate saves, do final save
+        number_of_sv = finish(sv, problem); // if haven't done any intermediate saves, do final save
         timer+=sw->get_time();
     }
+    if(cost_path.size()>1)
+		train_path(sv, problem, weight_pos, weight_neg);
 
     if(verbosity>0) 
 		cout << endl;
     cout << "nSVs=" << number_of_sv << endl;
     cout<< "||w||^2=" << lasvm_get_w2(sv) << endl;
     cout << "Kernel evaluations =" << kernel_evaluation_counter << endl;
+    delete sw;
+    lasvm_destroy(sv);
+}
+
+
+void train_path(lasvm_t *sv, subproblem& problem, double weight_pos, double weight_neg){
+    // each value of C starts from the solution of the previous one, on the same kernel cache,
+    // one pass over the examples picks up the new margin violators before finishing
+	for (unsigned long k=0; k < cost_path.size(); k++){
+		if (k > 0){
+			lasvm_set_c(sv, cost_path[k]*weight_pos, cost_path[k]*weight_neg);
+			for (unsigned long i=0; i < problem.examples.size(); i++){ // examples left out of the expansion may now violate the margin
+				lasvm_process(sv, problem.examples[i], problem.label(problem.examples[i]));
+				lasvm_reprocess(sv, epsilon_gradient);
+			}
+			do { 
+				lasvm_finish(sv, epsilon_gradient); 
+			} while (lasvm_get_delta(sv)>epsilon_gradient);
+			finish(sv, problem);
+		}
+		subproblem solution;
+		solution.positive = problem.positive;
+		solution.negative = problem.negative;
+		solution.svind = problem.svind;
+		solution.svalpha = problem.svalpha;
+		solution.threshold = problem.threshold;
+		problem.path.push_back(solution);
+		if (verbosity > 0)
+			cout << "C=" << cost_path[k] << " nSVs=" << problem.svind.size() << " ||w||^2=" << lasvm_get_w2(sv) << endl;
+	}
+}
+
+static void write_indices(FILE *f, const vector<unsigned long>& v){
+	unsigned long n = static_cast<unsigned long>(v.size());
+	fwrite(&n, sizeof(unsigned long), 1, f);
+	fwrite(v.data(), sizeof(unsigned long), n, f);
+}
+
+static bool read_indices(FILE *f, vector<unsigned long>& v){
+	unsigned long n = 0;
+	if (fread(&n, sizeof(unsigned long), 1, f) != 1 || n > number_of_instances)
+		return false;
+	v.resize(n);
+	return fread(v.data(), sizeof(unsigned long), n, f) == n;
+}
+
+void save_checkpoint(lasvm_t *sv, const vector<double>& w, int epoch, unsigned long position, 
+                     const vector<unsigned long>& inew, const vector<unsigned long>& iold, const vector<unsigned long>& sizes){
+    // solver state followed by the driver state, written next to the checkpoint then renamed over it
+	string tmp_file_name = checkpoint_file_name + ".tmp";
+	FILE *f = fopen(tmp_file_name.c_str(), "wb");
+	if (f == NULL){
+		cerr << "Can't write checkpoint " << tmp_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+	lasvm_save_state(sv, f);
+	long e = epoch;
+	unsigned long long counters[2] = { job_random_state ? *job_random_state : random_state.load(), kernel_evaluation_counter.load() };
+	fwrite(&e, sizeof(long), 1, f);
+	fwrite(&position, sizeof(unsigned long), 1, f);
+	fwrite(counters, sizeof(unsigned long long), 2, f);
+	write_indices(f, inew);
+	write_indices(f, iold);
+	write_indices(f, sizes);
+	fwrite(w.data(), sizeof(double), w.size(), f); // as accumulated, rebuilding it would round differently
+	if (ferror(f) || fclose(f) != 0 || rename(tmp_file_name.c_str(), checkpoint_file_name.c_str()) != 0){
+		cerr << "Can't write checkpoint " << checkpoint_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (verbosity > 0)
+		cout << "..[checkpoint]";
+}
+
+bool load_checkpoint(lasvm_t *sv, vector<double>& w, int& epoch, unsigned long& position, 
+                     vector<unsigned long>& inew, vector<unsigned long>& iold, vector<unsigned long>& sizes){
+	if (checkpoint_file_name.empty())
+		return false;
+	FILE *f = fopen(checkpoint_file_name.c_str(), "rb");
+	if (f == NULL)
+		return false;
+	lasvm_load_state(sv, f);
+	long e = 0;
+	unsigned long long counters[2] = {0, 0};
+	bool ok = fread(&e, sizeof(long), 1, f) == 1 
+		&& fread(&position, sizeof(unsigned long), 1, f) == 1
+		&& fread(counters, sizeof(unsigned long long), 2, f) == 2
+		&& read_indices(f, inew) && read_indices(f, iold) && read_indices(f, sizes)
+		&& fread(w.data(), sizeof(double), w.size(), f) == w.size();
+	fclose(f);
+	if (!ok){
+		cerr << "Invalid checkpoint " << checkpoint_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+	epoch = static_cast<int>(e);
+	if (job_random_state)
+		*job_random_state = counters[0];
+	else
+		random_state = counters[0];
+	kernel_evaluation_counter = counters[1];
+	return true;
+}
+
+
+void make_subproblems(vector<int>& labels, vector<subproblem>& problems){
+    // one binary sub-problem for two classes, several sharing X and Y otherwise
+	set<int> classes;
+	for (map<unsigned long, int>::iterator iter = Y.begin(); iter != Y.end(); iter++)
+		if (splits.empty() || splits.count(iter->first)) // a split file selects the training instances
+			classes.insert(iter->second);
+	labels.assign(classes.rbegin(), classes.rend()); // +1 comes first for binary problems
+	problems.clear();
+
+	if (labels.size() < 2){
+		cerr << "Training set needs at least two classes" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	if (labels.size() == 2 || multiclass_type == ONE_VS_REST){
+		unsigned long number_of_problems = (labels.size() == 2) ? 1 : static_cast<unsigned long>(labels.size());
+		for (unsigned long c=0; c < number_of_problems; c++){
+			subproblem problem;
+			problem.positive = labels[c];
+			if (labels.size() == 2)
+				problem.negative = labels[1];
+			for (unsigned long i=0; i < number_of_instances; i++)
+				if (splits.empty() || splits.count(i))
+					problem.examples.push_back(i);
+			problems.push_back(problem);
+		}
+	}
+	else { // one-vs-one, pairs in the same order as LIBSVM
+		for (unsigned long c=0; c < labels.size(); c++)
+			for (unsigned long d=c+1; d < labels.size(); d++){
+				subproblem problem;
+				problem.positive = labels[c];
+				problem.negative = labels[d];
+				for (unsigned long i=0; i < number_of_instances; i++)
+					if ((splits.empty() || splits.count(i)) && (Y.at(i) == labels[c] || Y.at(i) == labels[d]))
+						problem.examples.push_back(i);
+				problems.push_back(problem);
+			}
+	}
+}
+
+
+template<typename F> void run_parallel(unsigned long n, F job){
+    // workers pick the next job index until all <n> jobs are done,
+    // job k draws random numbers from its own state seeded from one draw of the caller and k
+	atomic<unsigned long> next(0);
+	vector<thread> workers;
+	unsigned long number_of_workers = min<unsigned long>(threads, n);
+	unsigned long long seed = llrand();
+	for (unsigned long w=0; w < number_of_workers; w++)
+		workers.push_back(thread([&](){
+			for (unsigned long k = next++; k < n; k = next++){
+				unsigned long long state = seed ^ mix64(k + 1);
+				job_random_state = &state;
+				job(k);
+				job_random_state = NULL;
+			}
+		}));
+	for (unsigned long w=0; w < number_of_workers; w++)
+		workers[w].join();
+}
+
+
+void merge_subproblems(const subproblem& a, const subproblem& b, subproblem& merged, unsigned long jobs){
+    // warm start from the union of both expansions and re-optimize it
+	merged.positive = a.positive;
+	merged.negative = a.negative;
+	merged.examples = a.examples;
+	merged.examples.insert(merged.examples.end(), b.examples.begin(), b.examples.end());
+	vector<unsigned long> svind(a.svind);
+	vector<double> svalpha(a.svalpha);
+	svind.insert(svind.end(), b.svind.begin(), b.svind.end());
+	svalpha.insert(svalpha.end(), b.svalpha.begin(), b.svalpha.end());
+
+    lasvm_kcache_t *kcache=lasvm_kcache_create(kernel, NULL);
+    lasvm_kcache_set_maximum_size(kcache, cache_size*1024*1024/jobs); // the memory budget is split among the merges
+    lasvm_t *sv=lasvm_create_precision(kcache,use_threshold,C*C_pos,C*C_neg,precision);
+	vector<double> w(number_of_features + 1, 0);  // explicit weight vector for the linear kernel
+	if (kernel_type == LINEAR)
+		lasvm_set_linear(sv, linear_dot, linear_update, &w);
+	lasvm_set_budget(sv, budget_size);
+	if (!svind.empty()){
+		lasvm_init(sv, static_cast<unsigned long>(svind.size()), svind.data(), svalpha.data(), NULL);
+		do { 
+			lasvm_finish(sv, epsilon_gradient); 
+		} while (lasvm_get_delta(sv)>epsilon_gradient);
+	}
+	unsigned long number_of_sv = finish(sv, merged);
+	cout << "..[merged " << a.svind.size() << "+" << b.svind.size() << " SVs into " << number_of_sv << "]" << endl;
     lasvm_destroy(sv);
     lasvm_kcache_destroy(kcache);
 }
 
 
+void train_cascade(char *model_file_name, subproblem& problem){
+    // shuffle the examples into <shards> partitions trained independently
+	vector<unsigned long> examples(problem.examples);
+	for (unsigned long i = static_cast<unsigned long>(examples.size()); i > 1; i--)
+		swap(examples[i-1], examples[llrand() % i]);
+
+	vector<subproblem> level(min<unsigned long>(shards, static_cast<unsigned long>(examples.size())));
+	for (unsigned long i=0; i < examples.size(); i++)
+		level[i % level.size()].examples.push_back(examples[i]);
+	for (unsigned long k=0; k < level.size(); k++){
+		level[k].positive = problem.positive;
+		level[k].negative = problem.negative;
+	}
+	cout << "[cascade: " << level.size() << " partitions]" << endl;
+	unsigned long jobs = min<unsigned long>(threads, level.size());
+	run_parallel(static_cast<unsigned long>(level.size()), [&](unsigned long k){ 
+		train_online(model_file_name, level[k], 1, jobs); 
+	});
+
+    // merge neighbouring models level by level, an odd one out moves up unchanged
+	while (level.size() > 1){
+		vector<subproblem> next((level.size() + 1) / 2);
+		unsigned long merges = min<unsigned long>(threads, level.size() / 2);
+		run_parallel(static_cast<unsigned long>(next.size()), [&](unsigned long k){
+			if (2*k+1 < level.size())
+				merge_subproblems(level[2*k], level[2*k+1], next[k], merges);
+			else
+				next[k] = level[2*k];
+		});
+		level.swap(next);
+	}
+	problem.svind = level[0].svind;
+	problem.svalpha = level[0].svalpha;
+	problem.threshold = level[0].threshold;
+}
+
+
+double holdout_accuracy(const subproblem& solution, const vector<unsigned long>& examples, double *gamma){
+    // percentage of the examples on the right side of the decision function
+	unsigned long correct = 0;
+	for (unsigned long i=0; i < examples.size(); i++){
+		double f = -solution.threshold;
+		for (unsigned long j=0; j < solution.svind.size(); j++)
+			f += solution.svalpha[j] * kernel(solution.svind[j], examples[i], gamma);
+		if ((f > 0) == (solution.label(examples[i]) > 0))
+			correct++;
+	}
+	return 100.0 * static_cast<double>(correct) / static_cast<double>(examples.size());
+}
+
+
+void grid_search(char *model_file_name, subproblem& problem){
+    // trains every (gamma, w1, C) on the same examples and scores it on held-out ones,
+    // one job and one kernel cache per gamma, the values of C of a job form a warm-started path
+	if (shards > 1 || saves > 1 || !checkpoint_file_name.empty()){
+		cerr << "The grid search (-G) can't be combined with cascade training, intermediate models or checkpoints" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (gamma_grid.empty()) 
+		gamma_grid.push_back(kgamma);
+	if (cost_path.empty()) 
+		cost_path.push_back(C);
+	if (weight_grid.empty()) 
+		weight_grid.push_back(C_pos);
+
+	vector<unsigned long> examples(problem.examples);
+	for (unsigned long i = static_cast<unsigned long>(examples.size()); i > 1; i--)
+		swap(examples[i-1], examples[llrand() % i]);
+	unsigned long number_of_scoring = static_cast<unsigned long>(holdout * static_cast<double>(examples.size()));
+	if (number_of_scoring == 0 || number_of_scoring >= examples.size()){
+		cerr << "The held-out fraction (-G) leaves no examples to train or to score" << endl;
+		exit(EXIT_FAILURE);
+	}
+	vector<unsigned long> scoring(examples.begin(), examples.begin() + number_of_scoring);
+	subproblem training;
+	training.positive = problem.positive;
+	training.negative = problem.negative;
+	training.examples.assign(examples.begin() + number_of_scoring, examples.end());
+
+	unsigned long number_of_costs = static_cast<unsigned long>(cost_path.size());
+	unsigned long number_of_weights = static_cast<unsigned long>(weight_grid.size());
+	unsigned long number_of_gammas = static_cast<unsigned long>(gamma_grid.size());
+	unsigned long jobs = min(threads, number_of_gammas);
+	vector<subproblem> solutions(number_of_gammas * number_of_weights * number_of_costs);
+	vector<double> accuracy(solutions.size(), 0);
+	run_parallel(number_of_gammas, [&](unsigned long g){
+		lasvm_kcache_t *kcache=lasvm_kcache_create(kernel, &gamma_grid[g]);
+		lasvm_kcache_set_maximum_size(kcache, cache_size*1024*1024/jobs); // the memory budget is split among the jobs
+		for (unsigned long w=0; w < number_of_weights; w++){
+			subproblem run(training);
+			train_online(model_file_name, run, kcache, weight_grid[w], C_neg);
+			for (unsigned long c=0; c < number_of_costs; c++){
+				unsigned long k = (g * number_of_weights + w) * number_of_costs + c;
+				if (number_of_costs > 1)
+					solutions[k] = run.path[c];
+				else {
+					solutions[k] = run;
+					solutions[k].examples.clear();
+				}
+				accuracy[k] = holdout_accuracy(solutions[k], scoring, &gamma_grid[g]);
+			}
+		}
+		lasvm_kcache_destroy(kcache);
+	});
+
+	unsigned long best = 0;
+	cout << endl << "gamma\tC\tw1\tnSVs\taccuracy" << endl;
+	for (unsigned long g=0; g < number_of_gammas; g++)
+		for (unsigned long w=0; w < number_of_weights; w++)
+			for (unsigned long c=0; c < number_of_costs; c++){
+				unsigned long k = (g * number_of_weights + w) * number_of_costs + c;
+				cout << gamma_grid[g] << "\t" << cost_path[c] << "\t" << weight_grid[w] << "\t" 
+					 << solutions[k].svind.size() << "\t" << accuracy[k] << endl;
+				if (accuracy[k] > accuracy[best])
+					best = k;
+			}
+	unsigned long best_gamma = best / (number_of_weights * number_of_costs);
+	unsigned long best_weight = (best / number_of_costs) % number_of_weights;
+	cout << "Best: gamma=" << gamma_grid[best_gamma] << " C=" << cost_path[best % number_of_costs] 
+		 << " w1=" << weight_grid[best_weight] << " accuracy=" << accuracy[best] << endl;
+
+	// the model file gets the best solution, trained without the held-out examples
+	kgamma = gamma_grid[best_gamma];
+	problem.svind = solutions[best].svind;
+	problem.svalpha = solutions[best].svalpha;
+	problem.threshold = solutions[best].threshold;
+}
+
+
+void train_subproblems(char *model_file_name, vector<subproblem>& problems){
+	if (shards > 1 && saves > 1){
+		cerr << "Intermediate models (-l) are not saved by cascade training" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (cost_path.size() > 1 && (shards > 1 || saves > 1)){
+		cerr << "A regularization path (-c) can't be combined with cascade training or intermediate models (-l)" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (!checkpoint_file_name.empty() && (shards > 1 || problems.size() > 1)){
+		cerr << "Checkpoints (-K) are only written for two classes without cascade training" << endl;
+		exit(EXIT_FAILURE);
+	}
+	if (shards > 1){ // the cascade uses the threads, sub-problems go one after the other
+		for (unsigned long k=0; k < problems.size(); k++)
+			train_cascade(model_file_name, problems[k]);
+		return;
+	}
+	if (problems.size() == 1){
+		train_online(model_file_name, problems[0], threads, 1);
+		return;
+	}
+	if (saves > 1){
+		cerr << "Intermediate models (-l) are only saved for two classes" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+    // X and Y are shared read-only by the workers
+	unsigned long jobs = min<unsigned long>(threads, problems.size());
+	run_parallel(static_cast<unsigned long>(problems.size()), [&](unsigned long k){ 
+		train_online(model_file_name, problems[k], 1, jobs); 
+	});
+}
+
+
+int predict_label(const vector<subproblem>& models, const vector<int>& labels, unsigned long i){
+    // same decision as la_test: sign, largest output for one-vs-rest, most votes for one-vs-one
+	vector<double> f(models.size());
+	for (unsigned long k=0; k < models.size(); k++){
+		f[k] = -models[k].threshold;
+		for (unsigned long j=0; j < models[k].svind.size(); j++)
+			f[k] += models[k].svalpha[j] * kernel(models[k].svind[j], i, NULL);
+	}
+	if (models.size() == 1)
+		return f[0] > 0 ? models[0].positive : models[0].negative;
+	if (multiclass_type == ONE_VS_REST)
+		return models[max_element(f.begin(), f.end()) - f.begin()].positive;
+	vector<unsigned long> votes(labels.size(), 0);
+	for (unsigned long k=0; k < models.size(); k++){
+		int winner = f[k] > 0 ? models[k].positive : models[k].negative;
+		votes[find(labels.begin(), labels.end(), winner) - labels.begin()]++;
+	}
+	return labels[max_element(votes.begin(), votes.end()) - votes.begin()];
+}
+
+
+void cross_validation(char *model_file_name, const vector<subproblem>& problems, const vector<int>& labels){
+    // trains the folds concurrently on the shared data, each without its own instances
+	if (shards > 1 || saves > 1 || !checkpoint_file_name.empty() || cost_path.size() > 1 || holdout > 0){
+		cerr << "Cross-validation can't be combined with cascade training, intermediate models, checkpoints, "
+			 << "regularization paths or grid search" << endl;
+		exit(EXIT_FAILURE);
+	}
+	vector<long> fold_of(number_of_instances, -1); // instances without a fold are always trained on
+	unsigned long number_of_folds = folds;
+	if (!fold_file_name.empty()){
+		int is_binary_file = 0, instance_index_in = 0, labels_in = 0;
+		string data_file_name;
+		map<unsigned long, int> assignment = split_file_load(const_cast<char*>(fold_file_name.c_str()), data_file_name, 
+		                                                     is_binary_file, instance_index_in, labels_in);
+		if (!instance_index_in || !labels_in){
+			cerr << "Split file " << fold_file_name << " must give the fold of each instance as its label" << endl;
+			exit(EXIT_FAILURE);
+		}
+		number_of_folds = 0;
+		for (map<unsigned long, int>::iterator iter = assignment.begin(); iter != assignment.end(); iter++)
+			if (iter->first < number_of_instances && iter->second > 0){
+				fold_of[iter->first] = iter->second - 1;
+				number_of_folds = max(number_of_folds, static_cast<unsigned long>(iter->second));
+			}
+	}
+	else {
+		vector<unsigned long> examples;
+		for (unsigned long i=0; i < number_of_instances; i++)
+			if (splits.empty() || splits.count(i))
+				examples.push_back(i);
+		for (unsigned long i = static_cast<unsigned long>(examples.size()); i > 1; i--)
+			swap(examples[i-1], examples[llrand() % i]);
+		for (unsigned long i=0; i < examples.size(); i++)
+			fold_of[examples[i]] = static_cast<long>(i % folds);
+	}
+	if (number_of_folds < 2){
+		cerr << "Cross-validation needs at least two folds" << endl;
+		exit(EXIT_FAILURE);
+	}
+
+	vector<unsigned long> trained(number_of_folds, 0), tested(number_of_folds, 0), correct(number_of_folds, 0);
+	vector<double> seconds(number_of_folds, 0);
+	unsigned long jobs = min(threads, number_of_folds);
+	run_parallel(number_of_folds, [&](unsigned long f){
+		chrono::steady_clock::time_point start = chrono::steady_clock::now();
+		vector<subproblem> models(problems);
+		for (unsigned long k=0; k < models.size(); k++){
+			vector<unsigned long> examples;
+			for (unsigned long i=0; i < problems[k].examples.size(); i++)
+				if (fold_of[problems[k].examples[i]] != static_cast<long>(f))
+					examples.push_back(problems[k].examples[i]);
+			models[k].examples.swap(examples);
+			train_online(model_file_name, models[k], 1, jobs);
+		}
+		seconds[f] = chrono::duration<double>(chrono::steady_clock::now() - start).count();
+		for (unsigned long i=0; i < number_of_instances; i++){
+			if (!splits.empty() && !splits.count(i))
+				continue;
+			if (fold_of[i] != static_cast<long>(f))
+				trained[f]++;
+			else {
+				tested[f]++;
+				if (predict_label(models, labels, i) == Y.at(i))
+					correct[f]++;
+			}
+		}
+	});
+
+	double mean_accuracy = 0, mean_seconds = 0;
+	cout << endl << "fold\ttrain\ttest\taccuracy\tsecs" << endl;
+	for (unsigned long f=0; f < number_of_folds; f++){
+		double accuracy = tested[f] ? 100.0 * static_cast<double>(correct[f]) / static_cast<double>(tested[f]) : 0;
+		cout << f+1 << "\t" << trained[f] << "\t" << tested[f] << "\t" << accuracy << "\t" << seconds[f] << endl;
+		mean_accuracy += accuracy / static_cast<double>(number_of_folds);
+		mean_seconds += seconds[f] / static_cast<double>(number_of_folds);
+	}
+	cout << "Cross-validation accuracy = " << mean_accuracy << " (mean of " << number_of_folds << " folds, " 
+		 << mean_seconds << " secs per fold)" << endl;
+}
+
+
+void write_profile(){
+	// writes the phase report requested by -R
+	if (profile_file_name.empty())
+		return;
+	if (profile_file_name == "-"){
+		lasvm_profile_report(stdout);
+		return;
+	}
+	FILE *f = fopen(profile_file_name.c_str(), "w");
+	if (!f){
+		cerr << "Could not open file:" << profile_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+	lasvm_profile_report(f);
+	fclose(f);
+}
+
+
+void approximate_kernel(){
+	// replaces every example x by z(x) and trains the linear kernel on them
+	if (kernel_type != RBF || gamma_grid.size() > 1 || stream_window > 0){
+		cerr << "The kernel approximation (-a) needs the rbf kernel, a single gamma and no streaming" << endl;
+		exit(EXIT_FAILURE);
+	}
+	stopwatch *sw = new stopwatch;
+	if (approximation == LASVM_APPROX_FOURIER)
+		lasvm_approx_fourier(feature_map, kgamma, approximation_dimension, number_of_features, llrand());
+	else if (approximation == LASVM_APPROX_NYSTROM){
+		vector<unsigned long> order(number_of_instances);
+		iota(order.begin(), order.end(), 0);
+		unsigned long landmarks_size = min(approximation_dimension, number_of_instances);
+		for (unsigned long i = 0; i < landmarks_size; i++) // partial shuffle, the first ones are the landmarks
+			swap(order[i], order[i + llrand() % (order.size() - i)]);
+		vector<lasvm_sparsevector_t> landmarks;
+		for (unsigned long i = 0; i < landmarks_size; i++)
+			landmarks.push_back(X.at(order[i]));
+		lasvm_approx_nystrom(feature_map, kgamma, landmarks);
+	}
+	else {
+		cerr << "Unknown kernel approximation " << approximation << endl;
+		exit(EXIT_FAILURE);
+	}
+	Z.resize(number_of_instances);
+	run_parallel(number_of_instances, [&](unsigned long i){ // keeps only the dense copy, see example()
+		lasvm_sparsevector_t z = lasvm_approx_apply(feature_map, X.at(i));
+		Z[i].assign(feature_map.dimension, 0);
+		for (lasvm_sparsevector_t::const_iterator iter = z.begin(); iter != z.end(); iter++)
+			Z[i][iter->first - 1] = iter->second;
+		X.at(i).clear();
+	});
+	kernel_type = LINEAR;
+	linear_model = 1;
+	number_of_features = feature_map.dimension;
+	x_square.clear();
+	cout << "Mapped the examples on " << feature_map.dimension << " " << lasvm_approx_table[feature_map.type] << " features" << endl;
+	delete sw;
+}
+
+
+void train_stream(char *input_file_name, char *model_file_name){
+    // X and Y hold slots reused by later examples: the window plus the support vectors
+	if (shards > 1 || saves > 1 || !checkpoint_file_name.empty() || cost_path.size() > 1 || holdout > 0 || folds > 0 
+		|| !fold_file_name.empty() || is_binary != 0){
+		cerr << "Streaming (-I) reads libsvm examples, it can't be combined with cascade training, intermediate models, " 
+			 << "checkpoints, regularization paths, grid search or cross-validation" << endl;
+		exit(EXIT_FAILURE);
+	}
+	ifstream file;
+	if (strcmp(input_file_name, "-") != 0){
+		file.open(input_file_name);
+		if (!file.is_open()){
+			cerr << "Can't open input file: " << input_file_name << endl;
+			exit(EXIT_FAILURE);
+		}
+	}
+	istream& input = file.is_open() ? static_cast<istream&>(file) : cin;
+
+	subproblem problem;              // positive=1, negative=-1
+	vector<int> labels;
+	labels.push_back(problem.positive);
+	labels.push_back(problem.negative);
+	vector<unsigned long> window, seen; // slots waiting for selection, slots just selected
+	vector<unsigned long> free_slots;   // slots of examples neither waiting nor support vectors
+	set<unsigned long> retained;        // slots of the processed examples still in the expansion
+	unsigned long number_of_slots = 0, number_of_read = 0;
+	int c1 = 0, c2 = 0;                 // examples of each class processed, the first 5 of each are not reprocessed
+
+	lasvm_kcache_t *kcache=lasvm_kcache_create(kernel, NULL);
+	lasvm_kcache_set_maximum_size(kcache, cache_size*1024*1024);
+	lasvm_kcache_set_threads(kcache, threads);
+	lasvm_t *sv=lasvm_create_precision(kcache,use_threshold,C*C_pos,C*C_neg,precision);
+	vector<double> w(1, 0);          // explicit weight vector for the linear kernel, grows with the features
+	if (kernel_type == LINEAR)
+		lasvm_set_linear(sv, linear_dot, linear_update, &w);
+	lasvm_set_budget(sv, budget_size);
+	stopwatch *sw = new stopwatch;
+
+	int label = 0;
+	lasvm_sparsevector_t x;
+	bool more = true;
+	while (more || !window.empty()){
+		if (more && (more = libsvm_read_instance(input, label, x))){
+			unsigned long slot;
+			if (free_slots.empty()){
+				slot = number_of_slots++;
+				x_square.resize(number_of_slots);
+			}
+			else {
+				slot = free_slots.back();
+				free_slots.pop_back();
+			}
+			if (number_of_features < x.rbegin()->first){
+				number_of_features = x.rbegin()->first;
+				w.resize(number_of_features + 1, 0);
+			}
+			if (kgamma < 0)
+				kgamma = 1.0 / static_cast<double>(number_of_features); // as LIBSVM, from the first example
+			x_square[slot] = lasvm_sparsevector_square(x);
+			X[slot] = x;
+			Y[slot] = label > 0 ? problem.positive : problem.negative;
+			window.push_back(slot);
+			number_of_read++;
+			if (verbosity > 0 && (number_of_read % 1000) == 0)
+				cout << ".." << number_of_read;
+			if (more && window.size() < stream_window)
+				continue;
+		}
+		if (window.empty())
+			break;
+
+		unsigned long selected = select(sv, window, seen, NULL);
+		seen.clear();
+		lasvm_process(sv, selected, problem.label(selected));
+		if (problem.label(selected) > 0)
+			c1++;
+		else
+			c2++;
+		if (c1 >= 5 && c2 >= 5) // just as train_online balances the initial set
+			lasvm_reprocess(sv, epsilon_gradient);
+		retained.insert(selected);
+
+		// free the slots that left the expansion
+		unsigned long l = lasvm_get_l(sv);
+		unsigned long *i2r = lasvm_kcache_i2r(kcache, number_of_slots);
+		for (set<unsigned long>::iterator iter = retained.begin(); iter != retained.end(); ){
+			if (i2r[*iter] < l){
+				iter++;
+				continue;
+			}
+			lasvm_kcache_forget(kcache, *iter);
+			X.erase(*iter);
+			free_slots.push_back(*iter);
+			retained.erase(iter++);
+		}
+	}
+	if (verbosity > 0)
+		cout << endl;
+
+	if (number_of_read == 0){
+		cerr << "No examples in " << input_file_name << endl;
+		exit(EXIT_FAILURE);
+	}
+	unsigned long number_of_sv = finish(sv, problem);
+	cout << "Examples read=" << number_of_read << " slots=" << number_of_slots << endl;
+	cout << "nSVs=" << number_of_sv << endl;
+	cout << "||w||^2=" << lasvm_get_w2(sv) << endl;
+	cout << "Kernel evaluations =" << kernel_evaluation_counter << endl;
+	delete sw;
+	lasvm_destroy(sv);
+	lasvm_kcache_destroy(kcache);
+	libsvm_save_model(model_file_name, &problem, 1, labels);
+}
+
+
 int main(int argc, char **argv){
 
 	cout << endl << "la SVM" << endl << "______" << endl;
 	
 	int is_sparse = 1;
-	double threshold = 0;
     
     char input_file_name[1024] = {'\0'};
     char model_file_name[1024] = {'\0'};
     parse_command_line(argc, argv, input_file_name, model_file_name);
 
-	load_data_file(input_file_name, is_binary, number_of_features, number_of_instances, X, Y, x_square, kernel_type, kgamma, is_sparse, splits);
-
-	unsigned long *svind = nullptr;   // support vector indices
-	vector <double> alpha;            // alpha_i, SV weights
-	unsigned long number_of_sv = 0;
-	static vector <unsigned long> iold, inew;		  // sets of old (already seen) points + new (unseen) points
+	if (stream_window > 0){
+		train_stream(input_file_name, model_file_name);
+		write_profile();
+		return 0;
+	}
 
-    train_online(model_file_name, alpha, number_of_sv, svind, inew, iold, threshold, Y, number_of_instances);
+	unsigned long long load_start = lasvm_profile_begin();
+	load_data_file(input_file_name, is_binary, number_of_features, number_of_instances, X, Y, x_square, kernel_type, kgamma, is_sparse, splits);
+	lasvm_profile_end(LASVM_PHASE_LOAD, load_start);
+	if (approximation != LASVM_APPROX_NONE)
+		approximate_kernel();
+
+	vector<int> labels;               // class labels, in model order
+	vector<subproblem> problems;      // binary sub-problems
+	make_subproblems(labels, problems);
+
+	if (folds > 0 || !fold_file_name.empty()){
+		cross_validation(model_file_name, problems, labels);
+		write_profile();
+		return 0;
+	}
+	if (holdout > 0){
+		if (problems.size() != 1){
+			cerr << "The grid search (-G) is only run for two classes" << endl;
+			exit(EXIT_FAILURE);
+		}
+		grid_search(model_file_name, problems[0]);
+	}
+	else
+		train_subproblems(model_file_name, problems);
     
-    libsvm_save_model(model_file_name, number_of_sv, svind, threshold);
+    libsvm_save_model(model_file_name, problems.data(), static_cast<unsigned long>(problems.size()), labels);
+
+	if (cost_path.size() > 1 && holdout == 0)
+		for (unsigned long k=0; k < cost_path.size(); k++){ // one model per C, gathered over the sub-problems
+			vector<subproblem> models;
+			for (unsigned long p=0; p < problems.size(); p++)
+				models.push_back(problems[p].path[k]);
+			stringstream tmp;
+			tmp << model_file_name << "_C" << cost_path[k];
+			libsvm_save_model(const_cast<char*>(tmp.str().c_str()), models.data(), static_cast<unsigned long>(models.size()), labels);
+		}
+	if (!checkpoint_file_name.empty())
+		remove(checkpoint_file_name.c_str()); // the models are written, nothing left to resume
+	write_profile();
 }
-
@@ -0,0 +1,117 @@
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+#include "../src/lasvm/kcache.hpp"
+#include "../src/lasvm/lasvm.hpp"
+
+using namespace std;
+
+/* Budget tests: the number of support vectors never exceeds the
+   budget and the equality constraint still holds, including when
+   every support vector of the class being removed is at its bound. */
+
+static vector<double> points;
+static vector<double> labels;
+
+static double kernel(unsigned long i, unsigned long j, void *)
+{
+  double d = points[i] - points[j];
+  return exp(-d*d);
+}
+
+static int failures = 0;
+
+static void check(lasvm_t *svm, unsigned long maxsv, double c, const char *what)
+{
+  unsigned long l = lasvm_get_l(svm);
+  vector<unsigned long> sv(l);
+  vector<double> alpha(l);
+  double sum = 0;
+  lasvm_get_sv(svm, sv.data());
+  lasvm_get_alpha(svm, alpha.data());
+  if (l > maxsv)
+    {
+      printf("%s: %lu support vectors for a budget of %lu\n", what, l, maxsv);
+      failures++;
+    }
+  for (unsigned long k=0; k<l; k++)
+    {
+      double ya = labels[sv[k]] * alpha[k];
+      if (ya < -1e-6 || ya > c + 1e-6)
+        {
+          printf("%s: coefficient %g of example %lu out of its box\n", what, alpha[k], sv[k]);
+          failures++;
+        }
+      sum += alpha[k];
+    }
+  if (fabs(sum) > 1e-6)
+    {
+      printf("%s: coefficients sum to %g\n", what, sum);
+      failures++;
+    }
+}
+
+static void all_at_bound()
+{
+  /* positives at 1 and 2, negatives at -1 and -2, every coefficient
+     at its bound; then a positive lying among the negatives has the
+     worst margin and only the negatives can absorb its coefficient */
+  double x[] = { 1, 2, -1, -2, -1.5 };
+  double y[] = { +1, +1, -1, -1, +1 };
+  unsigned long sv[] = { 0, 1, 2, 3 };
+  double alpha[] = { 1, 1, -1, -1 };
+  points.assign(x, x+5);
+  labels.assign(y, y+5);
+  lasvm_kcache_t *cache = lasvm_kcache_create(kernel, 0);
+  lasvm_t *svm = lasvm_create(cache, 1, 1, 1);
+  lasvm_init(svm, 4, sv, alpha, 0);
+  lasvm_set_budget(svm, 4);
+  lasvm_process(svm, 4, +1);
+  check(svm, 4, 1, "all at bound");
+  lasvm_set_budget(svm, 2);
+  lasvm_process(svm, 4, +1);
+  check(svm, 2, 1, "all at bound, budget 2");
+  lasvm_destroy(svm);
+  lasvm_kcache_destroy(cache);
+}
+
+static void overlapping(double c, unsigned long maxsv)
+{
+  /* two overlapping classes with a small C, most coefficients at bound */
+  char what[64];
+  unsigned long n = 500;
+  srand(1);
+  points.resize(n);
+  labels.resize(n);
+  for (unsigned long i=0; i<n; i++)
+    {
+      labels[i] = (i % 2) ? +1 : -1;
+      points[i] = labels[i] * 0.3 + 2.0 * rand() / RAND_MAX - 1.0;
+    }
+  lasvm_kcache_t *cache = lasvm_kcache_create(kernel, 0);
+  lasvm_t *svm = lasvm_create(cache, 1, c, c);
+  lasvm_set_budget(svm, maxsv);
+  snprintf(what, sizeof(what), "overlapping C=%g budget %lu", c, maxsv);
+  for (unsigned long i=0; i<n; i++)
+    {
+      lasvm_process(svm, i, labels[i]);
+      check(svm, maxsv, c, what);
+      lasvm_reprocess(svm, 1e-3);
+      check(svm, maxsv, c, what);
+    }
+  lasvm_destroy(svm);
+  lasvm_kcache_destroy(cache);
+}
+
+int main()
+{
+  all_at_bound();
+  overlapping(0.1, 5);
+  overlapping(0.1, 1);
+  overlapping(10, 20);
+  if (failures)
+    printf("%d failures\n", failures);
+  return failures ? EXIT_FAILURE : EXIT_SUCCESS;
+}